@@ -1,50 +1,71 @@
+//! \file Async.hpp
+//! Loading images and samples in the background.
+
 // Undocumented for the first few iterations. Interface may change rapidly.
-// This is mainly a proof of concept. Stability will be the highest on OS X.
 
-#if 0
 #ifndef GOSU_ASYNC_HPP
 #define GOSU_ASYNC_HPP
 
 #include <Gosu/Fwd.hpp>
 #include <Gosu/TR1.hpp>
-#include <thread>
 #include <memory>
 #include <string>
 
 namespace Gosu
 {
+    //! Handle to a resource that is being loaded in the background. Copies
+    //! refer to the same resource.
     template<typename Result>
     class AsyncResult
     {
-        std::tr1::shared_ptr<std::tr1::try_mutex> mutex;
-        std::tr1::shared_ptr<std::auto_ptr<Result> > result;
-        
     public:
-        AsyncResult(const std::tr1::shared_ptr<std::tr1::try_mutex>& mutex,
-                    const std::tr1::shared_ptr<std::auto_ptr<Result> >& result)
-        : mutex(mutex), result(result)
+        //! Implemented by the functions that return an AsyncResult.
+        class Job
+        {
+        public:
+            virtual ~Job() {}
+            //! Returns true if the result can be taken, waiting for it first
+            //! if wait is true.
+            virtual bool poll(bool wait) = 0;
+            //! Only called after poll has returned true. Throws if loading
+            //! failed.
+            virtual std::auto_ptr<Result> take() = 0;
+        };
+
+    private:
+        std::tr1::shared_ptr<Job> job;
+
+    public:
+        explicit AsyncResult(const std::tr1::shared_ptr<Job>& job)
+        : job(job)
         {
         }
-        
+
+        //! Returns true if takeValue would not block.
         bool hasValue() const
         {
-            std::tr1::try_mutex::scoped_try_lock lock(*mutex);
-            return lock && result->get();
+            return job->poll(false);
         }
-        
+
+        //! Waits for the resource if necessary. Can only be called once;
+        //! afterwards, the caller owns the resource. Throws if loading failed.
         std::auto_ptr<Result> takeValue()
         {
-            std::tr1::try_mutex::scoped_lock lock(*mutex);
-            return *result;
+            job->poll(true);
+            return job->take();
         }
     };
-    
-	// TODO: Will only work if the window doesn't die inbetween.
-	// TODO: More functions to come; or a general interface?
 
-	AsyncResult<Image>
-		asyncNewImage(Window& window, const std::wstring& filename);
+    //! Decodes the image on a worker thread. Must be called, and the result
+    //! polled and taken, on the thread that owns the window, which also must
+    //! outlive the result. Where Window::createSharedContext is available,
+    //! the pixels are uploaded by another thread as well, so that drawing
+    //! does not stall for them.
+    AsyncResult<Image> asyncNewImage(Window& window, const std::wstring& filename,
+        bool tileable = false);
+
+    //! Decodes the sample on a worker thread.
+    AsyncResult<Sample> asyncNewSample(const std::wstring& filename);
 }
 
 #endif
-#endif
@@ -23,6 +23,7 @@ namespace Gosu
     class Sample;
     class Song;
     class TextInput;
+    class Tilemap;
     class Timer;
     class Window;
     class Writer;
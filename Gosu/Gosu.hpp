@@ -26,6 +26,7 @@
 #include <Gosu/Sockets.hpp>
 #include <Gosu/Text.hpp>
 #include <Gosu/TextInput.hpp>
+#include <Gosu/Tilemap.hpp>
 #include <Gosu/Timing.hpp>
 #include <Gosu/Utility.hpp>
 #include <Gosu/Version.hpp>
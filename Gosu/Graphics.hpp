@@ -18,8 +18,9 @@ namespace Gosu
     //! Returns the height, in pixels, of the user's primary screen.
     unsigned screenHeight();
     
-    //! Returns the maximum size of an texture that will be allocated
-    //! internally by Gosu.
+    //! The size of the smallest textures that Gosu packs images into.
+    //! Graphics::textureSize returns the size that is actually used, which
+    //! is usually larger.
     //! Useful when extending Gosu using OpenGL.
     unsigned const MAX_TEXTURE_SIZE = 1024;
     
@@ -43,6 +44,8 @@ namespace Gosu
     Transform scale(double factor);
     Transform scale(double factorX, double factorY, double fromX = 0, double fromY = 0);
     
+    class DrawOpQueue;
+    
     //! Serves as the target of all drawing and provides primitive drawing
     //! functionality.
     //! Usually created internally by Gosu::Window.
@@ -50,6 +53,9 @@ namespace Gosu
     {
         struct Impl;
         const std::auto_ptr<Impl> pimpl;
+        
+        // Lets Gosu's macros and tilemaps schedule GL blocks directly.
+        friend DrawOpQueue& currentQueue(Graphics& graphics);
 
     public:
         Graphics(unsigned physicalWidth, unsigned physicalHeight, bool fullscreen);
@@ -67,10 +73,91 @@ namespace Gosu
         //! without calling begin.
         bool begin(Color clearWithColor = Color::BLACK);
         //! Every call to begin must have a matching call to end.
-        void end();
+        //! Returns false if the frame was skipped because it was identical
+        //! to the previous one (see setSkipIdenticalFrames); then there is
+        //! nothing new to present.
+        bool end();
         //! Flushes the Z queue to the screen and starts a new one.
         //! Useful for games that are *very* composite in nature (splitscreen).
         void flush();
+        //! New images are uploaded to their textures in batches, when the
+        //! next flush needs them. Call this to upload them right away
+        //! instead, e.g. at the end of a loading screen. With an upload
+        //! thread, this only hands them over to it.
+        void commitTextures();
+        
+        //! (Experimental)
+        //! From now on, commitTextures hands the uploads to a new thread,
+        //! which calls makeCurrent first to bind its own OpenGL context
+        //! that shares textures with the calling thread's context, and
+        //! release before it ends. Throws if makeCurrent fails. Drawing or
+        //! reading a texture still waits for its uploads.
+        void startUploadThread(const std::tr1::function<void()>& makeCurrent,
+            const std::tr1::function<void()>& release);
+        //! Waits for all uploads and stops the upload thread, if any.
+        void stopUploadThread();
+        bool hasUploadThread() const;
+        //! Returns true if startUploadThread has failed before, so that
+        //! callers need not try again.
+        bool uploadThreadFailed() const;
+        
+        //! (Experimental)
+        //! From now on, hands finished frames to a new thread that performs
+        //! them while the calling thread records the next frame. That thread
+        //! calls makeCurrent first to bind its own OpenGL context, which must
+        //! share textures with the calling thread's context, present after
+        //! each frame, and release before it ends. begin() no longer clears
+        //! the screen directly, and functors passed to scheduleGL run on the
+        //! render thread. Throws if makeCurrent fails. Usually called by
+        //! Window.
+        void startRenderThread(const std::tr1::function<void()>& makeCurrent,
+            const std::tr1::function<void()>& present,
+            const std::tr1::function<void()>& release);
+        //! Waits for the last frame and stops the render thread, if any.
+        void stopRenderThread();
+        
+        //! (Experimental)
+        //! If enabled, end() compares everything that was drawn with the
+        //! previous frame and skips rendering identical frames. Frames that
+        //! contain GL code scheduled without an identity, or that use
+        //! beginGL, are always rendered. Disabled by default.
+        void setSkipIdenticalFrames(bool enabled);
+        //! Number of frames that were skipped so far.
+        unsigned long skippedFrames() const;
+        //! Makes sure that the next frame is rendered even if it is identical
+        //! to the previous one, e.g. because the window's contents were lost.
+        void invalidate();
+        
+        //! (Experimental)
+        //! If enabled, the GPU time of each frame is measured and reported
+        //! in FrameStats. Returns false if the driver cannot do this.
+        //! Disabled by default.
+        bool setGPUTiming(bool enabled);
+        
+        //! Width and height of the textures that images are packed into, and
+        //! that larger images are split up by. Chosen from what the driver
+        //! supports (GL_MAX_TEXTURE_SIZE), up to 4096, but never less than
+        //! MAX_TEXTURE_SIZE.
+        unsigned textureSize() const;
+        //! (Experimental)
+        //! Changes the size of textures created from now on. Must be a power
+        //! of two that the driver supports and at least MAX_TEXTURE_SIZE;
+        //! 8192 is worth a try for games with many huge images.
+        void setTextureSize(unsigned size);
+        
+        //! (Experimental)
+        //! Moves images out of textures that are less than maxOccupancy
+        //! (between 0 and 1) full into other textures, so that fewer textures
+        //! are needed. Textures that macros still refer to are left alone,
+        //! and images from renderToImage are not moved.
+        //! Can only be called between frames. Returns the number of textures
+        //! that were released.
+        unsigned compactTextures(double maxOccupancy = 0.5);
+        //! (Experimental)
+        //! If above 0, begin() calls compactTextures(maxOccupancy) after
+        //! images have been released and a texture is less full than that.
+        //! Disabled (0) by default.
+        void setAutoCompaction(double maxOccupancy);
         
         //! Finishes all pending Gosu drawing operations and executes
         //! the following OpenGL code in a clean environment.
@@ -83,7 +170,27 @@ namespace Gosu
         //! Gosu's rendering up to the Z level may not yet have been glFlush()ed.
         //! Note: You may not call any Gosu rendering functions from within the
         //! functor, and you must schedule it from within Window::draw's call tree.
-        void scheduleGL(const std::tr1::function<void()>& functor, ZPos z);
+        //! \param identity If not 0, promises that functors scheduled with
+        //! the same identity render the same thing, which lets identical
+        //! frames be skipped (see setSkipIdenticalFrames).
+        void scheduleGL(const std::tr1::function<void()>& functor, ZPos z,
+            std::tr1::uint64_t identity = 0);
+        
+        //! (Experimental)
+        //! Lets the calling thread draw in parallel to other threads. Until it
+        //! calls detachRecordingContext, everything that the thread draws goes
+        //! into the given context, which has its own transformation and
+        //! clipping stacks, and starts out with the resolution and settings
+        //! that the screen had at begin(). At flush, all contexts are merged
+        //! into the screen's queue; among operations with the same Z, the ones
+        //! drawn on the main thread come first, then those of each context in
+        //! ascending order.
+        //! Note: Only drawing and transformations are thread-safe; images
+        //! (including new glyphs of fonts) must be created on the main thread,
+        //! and all threads must be detached before the frame is flushed.
+        void attachRecordingContext(unsigned context);
+        //! Ends the calling thread's attachment to its recording context.
+        void detachRecordingContext();
         
         //! Enables clipping to a specified rectangle.
         void beginClipping(double x, double y, double width, double height);
@@ -99,10 +206,29 @@ namespace Gosu
         //! Most usually, the return value is passed to Image::Image().
         std::auto_ptr<Gosu::ImageData> endRecording(int width, int height);
         
+        //! (Experimental)
+        //! Calls the functor and renders everything that it draws into a new
+        //! image of the given size, with (0; 0) as its top left corner. The
+        //! image is an area on a texture like any other, so it can be drawn
+        //! as often as needed at no extra cost; render a new one when its
+        //! contents change. Clipping is not supported inside the functor.
+        //! Each call reads the rendered pixels back from the GPU and waits
+        //! for it, so avoid calling it every frame. Throws if the driver
+        //! lacks framebuffer objects or glBlendFuncSeparate.
+        //! Most usually, the return value is passed to Image::Image().
+        std::auto_ptr<Gosu::ImageData> renderToImage(unsigned width, unsigned height,
+            const std::tr1::function<void()>& functor);
+        
         //! Pushes one transformation onto the transformation stack.
         void pushTransform(const Transform& transform);
         //! Pops one transformation from the transformation stack.
         void popTransform();
+        //! (Experimental)
+        //! If enabled, Gosu applies the current transformation to vertices on
+        //! the CPU instead of loading it into OpenGL. This lets drawing
+        //! operations under many different transformations be batched into
+        //! one. Disabled by default.
+        void setPreTransformVertices(bool enabled);
 
         //! Draws a line from one point to another (last pixel exclusive).
         //! Note: OpenGL lines are not reliable at all and may have a missing pixel at the start
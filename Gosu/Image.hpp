@@ -78,6 +78,17 @@ namespace Gosu
             Color c = Color::WHITE,
             AlphaMode mode = amDefault) const;
 
+        //! Draws count copies of the image in one go, which is much faster
+        //! than calling drawRot() for each of them (e.g. for particles).
+        //! Every copy is centered on its position, like drawRot() with the
+        //! default center. The arrays must hold count elements each.
+        //! \param scales Optional, factor for both dimensions; 1 if null.
+        //! \param angles Optional, see drawRot(); 0 if null.
+        //! \param colors Optional; Color::WHITE if null.
+        void drawSprites(std::size_t count, const float* x, const float* y,
+            const float* scales, const float* angles, const Color* colors,
+            ZPos z, AlphaMode mode = amDefault) const;
+
         //! Provides access to the underlying image data object.
         ImageData& getData() const;
     };
@@ -7,6 +7,7 @@
 #include <Gosu/Color.hpp>
 #include <Gosu/GraphicsBase.hpp>
 #include <Gosu/Fwd.hpp>
+#include <cstddef>
 
 namespace Gosu
 {
@@ -47,6 +48,12 @@ namespace Gosu
             double x3, double y3, Color c3,
             double x4, double y4, Color c4,
             ZPos z, AlphaMode mode) const = 0;
+        
+        //! Draws many copies of this image; see Image::drawSprites. The
+        //! default implementation calls draw() for each of them.
+        virtual void drawSprites(std::size_t count, const float* x, const float* y,
+            const float* scales, const float* angles, const Color* colors,
+            ZPos z, AlphaMode mode) const;
             
         virtual const GLTexInfo* glTexInfo() const = 0;
         virtual Bitmap toBitmap() const = 0;
@@ -4,11 +4,92 @@
 #ifndef GOSU_INSPECTION_HPP
 #define GOSU_INSPECTION_HPP
 
+#include <Gosu/TR1.hpp>
+#include <cstddef>
+#include <string>
+
 namespace Gosu
 {
     //! Returns the current framerate, as determined by an unspecified and possibly
     //! horrible algorithm.
     int fps();
+    
+    //! Returns how many draw operations of the last frame were skipped because
+    //! they were completely outside of the screen or the active clipping rect.
+    unsigned culledDrawOps();
+    
+    //! What it took to render a frame. Times are in milliseconds.
+    //! When the window renders on a separate thread, the statistics of a
+    //! frame only become available along with the next frame.
+    struct FrameStats
+    {
+        //! Draw operations that were queued, and that were culled instead
+        //! (see culledDrawOps).
+        unsigned drawOps, culledDrawOps;
+        //! Draw calls that the queued operations were combined into. Macros
+        //! and tilemaps do their own drawing and count as GL blocks.
+        unsigned batches;
+        //! How often the texture, transform, clip rect or alpha mode had to
+        //! be changed between batches.
+        unsigned textureBinds, transformChanges, clipChanges, blendChanges;
+        //! Custom GL functors, macros and tilemaps that were run.
+        unsigned glBlocks;
+        //! Memory that the queued operations took up, in bytes, and how
+        //! many chunks of it had to be allocated from the heap for this
+        //! frame. Once a frame as large as this one has been drawn, no more
+        //! chunks are needed.
+        std::size_t arenaBytes;
+        unsigned arenaAllocations;
+        //! Time spent sorting by Z, and sending everything to OpenGL
+        //! (including the sorting).
+        double sortTime, submitTime;
+        //! Time spent presenting the frame, which includes waiting for vsync.
+        double swapWait;
+        //! Time the GPU spent on everything that was sent to it, and on the
+        //! macros and GL blocks among that. Only measured while
+        //! Graphics::setGPUTiming is enabled, otherwise 0. The GPU reports
+        //! these late, so they belong to a frame a few frames earlier.
+        double gpuSubmitTime, gpuMacroTime, gpuGLBlockTime;
+        //! True if the frame was identical to the one before and was not
+        //! rendered at all (see Graphics::setSkipIdenticalFrames).
+        bool skipped;
+        //! Time between this frame and the one before, over the last
+        //! FRAME_TIME_WINDOW frames: the median, the 95th and 99th
+        //! percentiles, and the maximum.
+        double frameTimeMedian, frameTime95, frameTime99, frameTimeMax;
+    };
+    
+    //! Number of frames that frame time statistics are taken over.
+    const unsigned FRAME_TIME_WINDOW = 120;
+    
+    //! Returns the statistics of the last frame.
+    FrameStats frameStats();
+    
+    //! Starts recording how much time is spent in each TraceZone, on all
+    //! threads. Gosu has its own zones around sorting and drawing, texture
+    //! uploads, image and sound decoding, text rendering and sockets.
+    void beginTracing();
+    
+    //! Stops recording and writes the zones to a file in the Chrome trace
+    //! event format, which chrome://tracing and Perfetto can open.
+    void endTracing(const std::wstring& filename);
+    
+    //! Marks the scope it lives in as a zone of the trace, if tracing. When
+    //! not tracing, this costs about as much as a function call.
+    class TraceZone
+    {
+        TraceZone(const TraceZone&);
+        TraceZone& operator=(const TraceZone&);
+        
+        const char* name;
+        std::tr1::uint64_t start;
+        
+    public:
+        //! \param name Must remain valid until the end of tracing, e.g. a
+        //! string literal.
+        explicit TraceZone(const char* name);
+        ~TraceZone();
+    };
 }
 
 #endif
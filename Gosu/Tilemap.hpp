@@ -0,0 +1,59 @@
+//! \file Tilemap.hpp
+//! Interface of the Tilemap class.
+
+#ifndef GOSU_TILEMAP_HPP
+#define GOSU_TILEMAP_HPP
+
+#include <Gosu/Fwd.hpp>
+#include <Gosu/Color.hpp>
+#include <Gosu/GraphicsBase.hpp>
+#include <Gosu/TR1.hpp>
+#include <vector>
+
+namespace Gosu
+{
+    //! A grid of tiles that are all taken from the same tileset, e.g. one
+    //! returned by loadTiles. The map is cut into chunks that are kept in
+    //! video memory, and only the chunks that are visible get drawn. For
+    //! large maps, this is much faster than drawing every tile as an Image.
+    class Tilemap
+    {
+        struct Impl;
+        std::tr1::shared_ptr<Impl> pimpl;
+
+    public:
+        //! Index of an empty cell.
+        static const int NO_TILE = -1;
+
+        //! Creates a map of width * height empty cells.
+        //! \param tileset All images must have the same size, and each must
+        //! reside in a single texture, which is the case for loadTiles
+        //! unless the tiles are huge.
+        Tilemap(Graphics& graphics, const std::vector<Image>& tileset,
+            unsigned width, unsigned height);
+
+        //! Width of the map, in tiles.
+        unsigned width() const;
+        //! Height of the map, in tiles.
+        unsigned height() const;
+        //! Width of a single tile, in pixels.
+        unsigned tileWidth() const;
+        //! Height of a single tile, in pixels.
+        unsigned tileHeight() const;
+
+        //! Returns the index into the tileset of the tile at (x; y), or
+        //! NO_TILE.
+        int tile(unsigned x, unsigned y) const;
+        //! Changing a tile only updates the part of the map around it before
+        //! the map is drawn the next time.
+        void setTile(unsigned x, unsigned y, int tile);
+
+        //! Draws the map so its upper left corner is at (x; y). Parts that
+        //! are outside of the screen (after applying the current transforms)
+        //! are skipped.
+        void draw(double x, double y, ZPos z,
+            Color c = Color::WHITE, AlphaMode mode = amDefault) const;
+    };
+}
+
+#endif
@@ -4,6 +4,8 @@
 #ifndef GOSU_TIMING_HPP
 #define GOSU_TIMING_HPP
 
+#include <Gosu/TR1.hpp>
+
 namespace Gosu
 {
     //! Freezes the current thread for at least the specified time.
@@ -11,6 +13,16 @@ namespace Gosu
 
     //! Incrementing, possibly wrapping millisecond timer.
     unsigned long milliseconds();
+
+    //! Monotonic nanosecond timer that counts from an arbitrary point and
+    //! does not wrap. Unlike milliseconds(), it is not affected by changes
+    //! to the system clock.
+    std::tr1::uint64_t nanoseconds();
+
+    //! Freezes the current thread for roughly the specified time. How
+    //! precise this is depends on the operating system's scheduler; it can
+    //! easily be off by a millisecond.
+    void sleepNanoseconds(std::tr1::uint64_t nanoseconds);
 }
 
 #endif
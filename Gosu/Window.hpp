@@ -104,6 +104,16 @@ namespace Gosu
         SharedContext createSharedContext();
         #endif
         
+        #ifdef GOSU_IS_X
+        //! (Experimental)
+        //! If enabled, a separate thread submits each frame to OpenGL and
+        //! swaps buffers while update() and draw() already run for the next
+        //! one. Must be called before show(). Functors passed to
+        //! Graphics::scheduleGL are then run on that thread, and
+        //! Graphics::beginGL cannot be used.
+        void setPipelinedRendering(bool enabled);
+        #endif
+        
         #ifdef GOSU_IS_IPHONE
         void* rootViewController() const;
         // iPhone-only callbacks for touch events.
@@ -1,38 +1,239 @@
 #include <Gosu/Async.hpp>
+#include <Gosu/Audio.hpp>
+#include <Gosu/Bitmap.hpp>
 #include <Gosu/Graphics.hpp>
 #include <Gosu/Image.hpp>
+#include <Gosu/Platform.hpp>
 #include <Gosu/TR1.hpp>
 #include <Gosu/Window.hpp>
+#include "Threading.hpp"
+#include "WorkerPool.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
 
-using namespace std;
-using namespace std::tr1;
+#if defined(GOSU_IS_MAC) && !defined(GOSU_IS_IPHONE)
+#include <OpenGL/OpenGL.h>
+#elif defined(GOSU_IS_X)
+#include <GL/glx.h>
+#endif
+#ifndef GOSU_IS_WIN
+#include <unistd.h>
+#endif
 
-namespace Gosu
+namespace
 {
-    namespace
+    unsigned workerCount()
     {
-        void asyncNewImage_Impl(Window& window, std::wstring filename,
-                            Window::SharedContext context,
-                            shared_ptr<try_mutex> mutex,
-                            shared_ptr<std::auto_ptr<Image> > result)
+        #ifdef GOSU_IS_WIN
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        long cores = info.dwNumberOfProcessors;
+        #else
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        #endif
+        // Leave a core to the main thread, and do not flood the disk.
+        return std::max(1L, std::min(cores - 1, 4L));
+    }
+
+    // Loads that have not started when the program exits are dropped.
+    Gosu::WorkerPool& workers()
+    {
+        static Gosu::WorkerPool pool(workerCount());
+        return pool;
+    }
+
+    #if defined(GOSU_IS_UNIX) && !defined(GOSU_IS_IPHONE)
+    // Also creates the context, on the upload thread, so that failing to
+    // create it counts as failing to start the thread. The context lives
+    // as long as the thread's functors.
+    void makeCurrent(Gosu::Window* window,
+        std::tr1::shared_ptr<Gosu::Window::SharedContext> context)
+    {
+        *context = window->createSharedContext();
+        (**context)();
+    }
+
+    // So that the context can be destroyed along with the upload thread.
+    void releaseCurrent()
+    {
+        #ifdef GOSU_IS_MAC
+        CGLSetCurrentContext(0);
+        #else
+        glXMakeCurrent(glXGetCurrentDisplay(), None, 0);
+        #endif
+    }
+
+    // Uploads stay on the main thread if this fails.
+    void startUploadThread(Gosu::Window& window)
+    {
+        Gosu::Graphics& graphics = window.graphics();
+        if (graphics.hasUploadThread() || graphics.uploadThreadFailed())
+            return;
+
+        try
+        {
+            std::tr1::shared_ptr<Gosu::Window::SharedContext> context(
+                new Gosu::Window::SharedContext);
+            graphics.startUploadThread(std::tr1::bind(makeCurrent, &window, context),
+                releaseCurrent);
+        }
+        catch (const std::exception&)
         {
-            try_mutex::scoped_lock lock(*mutex);
-            (*context)();
-            result->reset(new Image(window.graphics(), filename));
         }
     }
+    #else
+    void startUploadThread(Gosu::Window&)
+    {
+    }
+    #endif
+
+    // The worker decodes the file, then the main thread creates the image
+    // when it polls, as textures are only touched on the main thread. The
+    // image is only handed out on the poll after that, to give the upload
+    // thread some time.
+    class ImageJob : public Gosu::AsyncResult<Gosu::Image>::Job
+    {
+        Gosu::Graphics& graphics;
+        bool tileable;
+
+        Gosu::Mutex mutex;
+        Gosu::ConditionVariable changed;
+        // Belong to the worker until decoded is set.
+        bool decoded;
+        Gosu::Bitmap bitmap;
+        std::string error;
+
+        std::auto_ptr<Gosu::Image> image;
+        bool handedOut;
+
+    public:
+        ImageJob(Gosu::Graphics& graphics, bool tileable)
+        : graphics(graphics), tileable(tileable), decoded(false), handedOut(false)
+        {
+        }
+
+        void decode(const std::wstring& filename)
+        {
+            Gosu::Bitmap result;
+            std::string message;
+            try
+            {
+                Gosu::loadImageFile(result, filename);
+            }
+            catch (const std::exception& e)
+            {
+                message = e.what();
+            }
+
+            Gosu::Lock lock(mutex);
+            bitmap.swap(result);
+            error = message;
+            decoded = true;
+            changed.notifyAll();
+        }
+
+        bool poll(bool wait)
+        {
+            if (image.get() || handedOut)
+                return handedOut = true;
+
+            {
+                Gosu::Lock lock(mutex);
+                while (wait && !decoded)
+                    changed.wait(mutex);
+                if (!decoded)
+                    return false;
+            }
+            if (!error.empty())
+                return handedOut = true;
+
+            try
+            {
+                image.reset(new Gosu::Image(graphics, bitmap, tileable));
+                graphics.commitTextures();
+            }
+            catch (const std::exception& e)
+            {
+                error = e.what();
+            }
+            Gosu::Bitmap().swap(bitmap);
+            return handedOut = wait || !error.empty();
+        }
+
+        std::auto_ptr<Gosu::Image> take()
+        {
+            if (!error.empty())
+                throw std::runtime_error(error);
+            return image;
+        }
+    };
+
+    class SampleJob : public Gosu::AsyncResult<Gosu::Sample>::Job
+    {
+        Gosu::Mutex mutex;
+        Gosu::ConditionVariable changed;
+        bool loaded;
+        std::auto_ptr<Gosu::Sample> sample;
+        std::string error;
+
+    public:
+        SampleJob()
+        : loaded(false)
+        {
+        }
+
+        void load(const std::wstring& filename)
+        {
+            std::auto_ptr<Gosu::Sample> result;
+            std::string message;
+            try
+            {
+                result.reset(new Gosu::Sample(filename));
+            }
+            catch (const std::exception& e)
+            {
+                message = e.what();
+            }
+
+            Gosu::Lock lock(mutex);
+            sample = result;
+            error = message;
+            loaded = true;
+            changed.notifyAll();
+        }
+
+        bool poll(bool wait)
+        {
+            Gosu::Lock lock(mutex);
+            while (wait && !loaded)
+                changed.wait(mutex);
+            return loaded;
+        }
+
+        std::auto_ptr<Gosu::Sample> take()
+        {
+            Gosu::Lock lock(mutex);
+            if (!error.empty())
+                throw std::runtime_error(error);
+            return sample;
+        }
+    };
 }
 
 Gosu::AsyncResult<Gosu::Image>
-    Gosu::asyncNewImage(Window& window, const std::wstring& filename)
+    Gosu::asyncNewImage(Window& window, const std::wstring& filename, bool tileable)
+{
+    startUploadThread(window);
+
+    std::tr1::shared_ptr<ImageJob> job(new ImageJob(window.graphics(), tileable));
+    workers().schedule(std::tr1::bind(&ImageJob::decode, job, filename));
+    return AsyncResult<Image>(job);
+}
+
+Gosu::AsyncResult<Gosu::Sample> Gosu::asyncNewSample(const std::wstring& filename)
 {
-	shared_ptr<try_mutex> mutex(new try_mutex);
-	shared_ptr<auto_ptr<Image> > image(new std::auto_ptr<Image>);
-	thread thread(bind(asyncNewImage_Impl,
-						ref(window),
-                        filename,
-						window.createSharedContext(),
-						mutex,
-                        image));
-	return AsyncResult<Image>(mutex, image);
+    std::tr1::shared_ptr<SampleJob> job(new SampleJob);
+    workers().schedule(std::tr1::bind(&SampleJob::load, job, filename));
+    return AsyncResult<Sample>(job);
 }
@@ -2,6 +2,7 @@
 #define GOSUIMPL_AUDIO_AUDIOFILE_HPP
 
 #include <vector>
+#include <Gosu/Inspection.hpp>
 #include <Gosu/Platform.hpp>
 #ifdef GOSU_IS_MAC
 #include <OpenAL/al.h>
@@ -33,6 +34,7 @@ namespace Gosu
             if (!decodedData_.empty())
                 return decodedData_;
             
+            TraceZone zone("AudioFile::readData");
             for (;;)
             {
                 decodedData_.resize(decodedData_.size() + INCREMENT);
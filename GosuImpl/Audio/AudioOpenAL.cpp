@@ -1,8 +1,10 @@
 #include "ALChannelManagement.hpp"
 #include "OggFile.hpp"
+#include "../Threading.hpp"
 
 #include <Gosu/Audio.hpp>
 #include <Gosu/Math.hpp>
+#include <Gosu/Inspection.hpp>
 #include <Gosu/IO.hpp>
 #include <Gosu/Utility.hpp>
 #include <Gosu/Platform.hpp>
@@ -53,6 +55,9 @@ namespace
     
     Song* curSong = 0;
     bool curSongLooping;
+    
+    // Samples may also be created on worker threads; see asyncNewSample.
+    Gosu::Mutex channelManagementMutex;
 }
 
 // TODO: What is the NSAutoreleasePool good for?
@@ -60,12 +65,18 @@ namespace
 #include "MacUtility.hpp"
     #define CONSTRUCTOR_COMMON \
         ObjRef<NSAutoreleasePool> pool([[NSAutoreleasePool alloc] init]); \
-        if (!alChannelManagement.get()) \
-            alChannelManagement.reset(new ALChannelManagement)
+        { \
+            Gosu::Lock lock(channelManagementMutex); \
+            if (!alChannelManagement.get()) \
+                alChannelManagement.reset(new ALChannelManagement); \
+        }
 #else
     #define CONSTRUCTOR_COMMON \
-        if (!alChannelManagement.get()) \
-            alChannelManagement.reset(new ALChannelManagement)
+        { \
+            Gosu::Lock lock(channelManagementMutex); \
+            if (!alChannelManagement.get()) \
+                alChannelManagement.reset(new ALChannelManagement); \
+        }
 #endif    
 
 Gosu::SampleInstance::SampleInstance(int handle, int extra)
@@ -350,6 +361,7 @@ class Gosu::Song::StreamData : public BaseData
         static const unsigned BUFFER_SIZE = 4096 * 8;
         #endif
         char audioData[BUFFER_SIZE];
+        TraceZone zone("AudioFile::readData");
         std::size_t readBytes = file->readData(audioData, BUFFER_SIZE);
         if (readBytes > 0)
             alBufferData(buffer, file->format(), audioData, readBytes, file->sampleRate());
@@ -585,6 +597,7 @@ void Gosu::Song::changeVolume(double volume)
 
 void Gosu::Song::update()
 {
+    TraceZone zone("Song::update");
     if (currentSong())
         currentSong()->data->update();
 }
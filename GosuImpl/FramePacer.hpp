@@ -0,0 +1,99 @@
+#ifndef GOSUIMPL_FRAMEPACER_HPP
+#define GOSUIMPL_FRAMEPACER_HPP
+
+#include <Gosu/Timing.hpp>
+#include <Gosu/TR1.hpp>
+#include <algorithm>
+
+namespace Gosu
+{
+    // Schedules the ticks of a main loop at a fixed, possibly fractional
+    // interval.
+    //
+    // Deadlines are computed from the previous deadline rather than from the
+    // time the loop actually woke up, so that small errors do not add up:
+    // at 16.666 ms, ticks alternate between 16 and 17 ms as needed to stay
+    // at 60 per second. Most of the waiting is done by sleeping, and the
+    // last bit by spinning, as the OS tends to oversleep. How long to spin
+    // is learned from how much the sleeps have overshot so far.
+    class FramePacer
+    {
+        typedef std::tr1::uint64_t Nanoseconds;
+
+        Nanoseconds interval, deadline;
+        // Time left before a deadline that is spent spinning, not sleeping.
+        Nanoseconds spinMargin;
+
+        static const Nanoseconds MIN_SPIN_MARGIN = 100000;
+        static const Nanoseconds MAX_SPIN_MARGIN = 4000000;
+
+        // Sleeps until about the given time.
+        void sleepUntil(Nanoseconds wanted)
+        {
+            Nanoseconds now = nanoseconds();
+            if (now >= wanted)
+                return;
+
+            sleepNanoseconds(wanted - now);
+            Nanoseconds woken = nanoseconds();
+
+            // Grow the margin right away if the sleep overshot by more than
+            // it, but let it shrink only slowly.
+            Nanoseconds overshoot = woken > wanted ? woken - wanted : 0;
+            spinMargin = std::max(overshoot + overshoot / 4, spinMargin - spinMargin / 16);
+            spinMargin = std::max(Nanoseconds(MIN_SPIN_MARGIN),
+                std::min(spinMargin, Nanoseconds(MAX_SPIN_MARGIN)));
+        }
+
+    public:
+        explicit FramePacer(double intervalInMs)
+        : interval(static_cast<Nanoseconds>(intervalInMs * 1000000)),
+          spinMargin(1000000)
+        {
+            deadline = nanoseconds() + interval;
+        }
+
+        // Returns true if the next tick is due.
+        bool due() const
+        {
+            return nanoseconds() >= deadline;
+        }
+
+        // Waits until the next tick is due, but at most the given time, so
+        // that loops can keep handling events in between.
+        void wait(Nanoseconds maximum = Nanoseconds(-1))
+        {
+            Nanoseconds now = nanoseconds();
+            if (now >= deadline)
+                return;
+
+            // Sleep until the deadline is within the spin margin, and only
+            // spin from there. A capped wait that ends before then returns
+            // without spinning.
+            if (deadline - now > spinMargin)
+            {
+                Nanoseconds untilSpin = deadline - now - spinMargin;
+                if (maximum < untilSpin)
+                {
+                    sleepUntil(now + maximum);
+                    return;
+                }
+                sleepUntil(now + untilSpin);
+            }
+            while (nanoseconds() < deadline);
+        }
+
+        // Call when starting a tick that was due.
+        void advance()
+        {
+            deadline += interval;
+            // After falling behind by more than a tick (e.g. during a long
+            // loading screen), resume from now instead of racing to catch up.
+            Nanoseconds now = nanoseconds();
+            if (now > deadline)
+                deadline = now + interval;
+        }
+    };
+}
+
+#endif
@@ -1,5 +1,6 @@
 #include <Gosu/Graphics.hpp>
 #include <Gosu/Bitmap.hpp>
+#include <Gosu/Inspection.hpp>
 #include <Gosu/IO.hpp>
 #include <Gosu/Platform.hpp>
 #include <Gosu/Utility.hpp>
@@ -96,6 +97,7 @@ namespace Gosu { bool isExtension(const wchar_t* str, const wchar_t* ext); }
 
 void Gosu::loadImageFile(Bitmap& bitmap, const std::wstring& filename)
 {
+    TraceZone zone("loadImageFile");
     ObjRef<NSAutoreleasePool> pool([NSAutoreleasePool new]);
     ObjRef<NSString> filenameRef([[NSString alloc] initWithUTF8String: wstringToUTF8(filename).c_str()]);
     ObjRef<APPLE_IMAGE> image([[APPLE_IMAGE alloc] initWithContentsOfFile: filenameRef.obj()]);
@@ -109,6 +111,7 @@ void Gosu::loadImageFile(Bitmap& bitmap, const std::wstring& filename)
 
 void Gosu::loadImageFile(Bitmap& bitmap, Reader reader)
 {
+    TraceZone zone("loadImageFile");
     char signature[2];
     reader.read(signature, 2);
     reader.seek(-2);
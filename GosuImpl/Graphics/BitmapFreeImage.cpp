@@ -1,4 +1,5 @@
 #include <Gosu/Bitmap.hpp>
+#include <Gosu/Inspection.hpp>
 #include <Gosu/IO.hpp>
 #include <Gosu/Platform.hpp>
 #include <Gosu/TR1.hpp>
@@ -120,6 +121,7 @@ namespace Gosu
 {
     void FI(loadImageFile)(Bitmap& bitmap, const std::wstring& filename)
     {
+        TraceZone zone("loadImageFile");
         #ifdef GOSU_IS_WIN
         FREE_IMAGE_FORMAT fif = FreeImage_GetFileTypeU(filename.c_str());
         FIBITMAP* fib = FreeImage_LoadU(fif, filename.c_str(), GOSU_FIFLAGS);
@@ -134,6 +136,7 @@ namespace Gosu
 
     void FI(loadImageFile)(Bitmap& bitmap, Gosu::Reader input)
     {
+        TraceZone zone("loadImageFile");
         // Read all available input
         std::vector<BYTE> data(input.resource().size() - input.position());
         input.read(&data[0], data.size());
@@ -1,5 +1,6 @@
 #include <Gosu/Graphics.hpp>
 #include <Gosu/Bitmap.hpp>
+#include <Gosu/Inspection.hpp>
 #include <Gosu/IO.hpp>
 #include <Gosu/Platform.hpp>
 #include <Gosu/TR1.hpp>
@@ -150,6 +151,7 @@ namespace
 
 void Gosu::loadImageFile(Gosu::Bitmap& result, const wstring& filename)
 {
+    TraceZone zone("loadImageFile");
     requireGDIplus();
 
     Gdiplus::Bitmap bitmap(filename.c_str());
@@ -159,6 +161,7 @@ void Gosu::loadImageFile(Gosu::Bitmap& result, const wstring& filename)
 
 void Gosu::loadImageFile(Gosu::Bitmap& result, Reader reader)
 {
+    TraceZone zone("loadImageFile");
     requireGDIplus();
 
     tr1::shared_ptr<IStream> stream = readToIStream(reader);
@@ -1,47 +1,277 @@
 #include "BlockAllocator.hpp"
+#include <Gosu/Inspection.hpp>
+#include <algorithm>
+#include <climits>
+#include <functional>
+#include <set>
 #include <stdexcept>
+#include <utility>
 #include <vector>
 
+namespace
+{
+    typedef Gosu::BlockAllocator::Block Block;
+
+    bool intersect(const Block& a, const Block& b)
+    {
+        return a.left < b.left + b.width && b.left < a.left + a.width &&
+            a.top < b.top + b.height && b.top < a.top + a.height;
+    }
+
+    bool contains(const Block& outer, const Block& inner)
+    {
+        return outer.left <= inner.left && inner.left + inner.width <= outer.left + outer.width &&
+            outer.top <= inner.top && inner.top + inner.height <= outer.top + outer.height;
+    }
+
+    // Whether the blocks share a piece of an edge, so that one could be
+    // grown into the other.
+    bool adjacent(const Block& a, const Block& b)
+    {
+        bool overlapX = a.left < b.left + b.width && b.left < a.left + a.width;
+        bool overlapY = a.top < b.top + b.height && b.top < a.top + a.height;
+        return (overlapY && (a.left + a.width == b.left || b.left + b.width == a.left)) ||
+            (overlapX && (a.top + a.height == b.top || b.top + b.height == a.top));
+    }
+
+    // Orders free rectangles by width or height first, so that alloc can
+    // start its search at the first one that is wide or high enough.
+    struct ByWidth
+    {
+        bool operator()(const Block& a, const Block& b) const
+        {
+            if (a.width != b.width)
+                return a.width < b.width;
+            if (a.height != b.height)
+                return a.height < b.height;
+            return a.left < b.left || (a.left == b.left && a.top < b.top);
+        }
+    };
+
+    struct ByHeight
+    {
+        bool operator()(const Block& a, const Block& b) const
+        {
+            if (a.height != b.height)
+                return a.height < b.height;
+            if (a.width != b.width)
+                return a.width < b.width;
+            return a.left < b.left || (a.left == b.left && a.top < b.top);
+        }
+    };
+}
+
+// Keeps a list of the maximal free rectangles (MaxRects): all free areas that
+// cannot be grown in any direction. They overlap each other, but every free
+// spot lies within one of them, so a block fits into the texture exactly if
+// it fits into one of them.
 struct Gosu::BlockAllocator::Impl
 {
     unsigned width, height;
 
     typedef std::vector<Block> Blocks;
-    Blocks blocks;
-    unsigned firstX, firstY;
-    unsigned maxW, maxH;
-    
-    void markBlockUsed(const Block& block, unsigned aWidth, unsigned aHeight)
-    {
-        firstX += aWidth;
-        if (firstX + aWidth >= width)
+    // Blocks in use, as returned by alloc() and as passed to block(). The
+    // latter may overlap the former.
+    Blocks blocks, nestedBlocks;
+    unsigned long usedArea;
+    Blocks freeRects;
+    // The same rectangles, sorted for alloc's search.
+    std::set<Block, ByWidth> freeByWidth;
+    std::set<Block, ByHeight> freeByHeight;
+    // Scratch space for cut() and release().
+    Blocks pieces, removed, local;
+    // Sizes of the free rectangles that are not both narrower and lower than
+    // another one, by decreasing width (and so increasing height). Usually
+    // much shorter than freeRects, and enough to tell if a block fits.
+    // Only brought up to date when a search fails, as textures that are
+    // being filled would otherwise pay for it on every allocation.
+    typedef std::pair<unsigned, unsigned> Size;
+    std::vector<Size> freeSizes;
+    bool freeSizesStale;
+
+    void updateFreeSizes()
+    {
+        freeSizes.clear();
+        for (Blocks::const_iterator i = freeRects.begin(); i != freeRects.end(); ++i)
+            freeSizes.push_back(Size(i->width, i->height));
+        std::sort(freeSizes.begin(), freeSizes.end(), std::greater<Size>());
+
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i < freeSizes.size(); ++i)
+            if (kept == 0 || freeSizes[i].second > freeSizes[kept - 1].second)
+                freeSizes[kept++] = freeSizes[i];
+        freeSizes.resize(kept);
+        freeSizesStale = false;
+    }
+
+    bool fits(unsigned width, unsigned height) const
+    {
+        for (std::size_t i = 0; i < freeSizes.size() && freeSizes[i].first >= width; ++i)
+            if (freeSizes[i].second >= height)
+                return true;
+        return false;
+    }
+
+    void addFreeRect(const Block& rect)
+    {
+        freeRects.push_back(rect);
+        freeByWidth.insert(rect);
+        freeByHeight.insert(rect);
+    }
+
+    void removeFreeRect(std::size_t index)
+    {
+        freeByWidth.erase(freeRects[index]);
+        freeByHeight.erase(freeRects[index]);
+        freeRects[index] = freeRects.back();
+        freeRects.pop_back();
+    }
+
+    // Cuts the block out of rects, a list of maximal free rectangles, and
+    // appends those it replaces to removed. Returns the index at which the
+    // new ones start.
+    std::size_t cut(Blocks& rects, const Block& block, Blocks& removed)
+    {
+        if (block.width == 0 || block.height == 0)
+            return rects.size();
+
+        // Replace each free rectangle that intersects the block by the parts
+        // of it to the left, right, top and bottom of the block.
+        pieces.clear();
+        for (std::size_t i = 0; i < rects.size(); )
+        {
+            Block free = rects[i];
+            if (!intersect(free, block))
+            {
+                ++i;
+                continue;
+            }
+
+            unsigned freeRight = free.left + free.width, freeBottom = free.top + free.height;
+            unsigned right = block.left + block.width, bottom = block.top + block.height;
+            if (block.left > free.left)
+                pieces.push_back(Block(free.left, free.top, block.left - free.left, free.height));
+            if (right < freeRight)
+                pieces.push_back(Block(right, free.top, freeRight - right, free.height));
+            if (block.top > free.top)
+                pieces.push_back(Block(free.left, free.top, free.width, block.top - free.top));
+            if (bottom < freeBottom)
+                pieces.push_back(Block(free.left, bottom, free.width, freeBottom - bottom));
+
+            removed.push_back(free);
+            rects[i] = rects.back();
+            rects.pop_back();
+        }
+
+        // Only the new pieces can lie within other free rectangles: the
+        // untouched ones were maximal before, so none of them lies within
+        // a piece of another one. This keeps pruning from being quadratic
+        // in the number of free rectangles.
+        std::size_t untouched = rects.size();
+        for (std::size_t i = 0; i < pieces.size(); ++i)
         {
-            firstX = 0;
-            firstY += aHeight;
+            bool redundant = false;
+            for (std::size_t j = 0; j < untouched && !redundant; ++j)
+                redundant = contains(rects[j], pieces[i]);
+            // Of identical pieces, keep the first.
+            for (std::size_t j = 0; j < pieces.size() && !redundant; ++j)
+                redundant = j != i && contains(pieces[j], pieces[i]) &&
+                    (j < i || !contains(pieces[i], pieces[j]));
+            if (!redundant)
+                rects.push_back(pieces[i]);
         }
-        blocks.push_back(block);
+        return untouched;
     }
 
-    bool isBlockFree(const Block& block) const
+    // Cuts the block out of the free rectangles.
+    void occupy(const Block& block)
     {
-        // (The right-th column and the bottom-th row are outside of the block.)
-        unsigned right = block.left + block.width;
-        unsigned bottom = block.top + block.height;
+        removed.clear();
+        std::size_t added = cut(freeRects, block, removed);
+        for (Blocks::const_iterator i = removed.begin(); i != removed.end(); ++i)
+        {
+            freeByWidth.erase(*i);
+            freeByHeight.erase(*i);
+        }
+        for (std::size_t i = added; i < freeRects.size(); ++i)
+        {
+            freeByWidth.insert(freeRects[i]);
+            freeByHeight.insert(freeRects[i]);
+        }
+        freeSizesStale = true;
+    }
 
-        // Block isn't valid.
-        if (right > width || bottom > height)
-            return false;
+    // Adds the area of a block that is no longer in use to the free
+    // rectangles. Only those adjacent to it can grow into it, and every new
+    // maximal rectangle lies within the bounding box of those and the block:
+    // its rows and columns through the block continue into them. So the
+    // free rectangles are only rebuilt within that box, from the blocks
+    // there, and the ones among them that overlap the freed block are
+    // maximal on the whole texture, too.
+    void release(const Block& freed)
+    {
+        unsigned left = freed.left, top = freed.top;
+        unsigned right = freed.left + freed.width, bottom = freed.top + freed.height;
+        for (Blocks::const_iterator i = freeRects.begin(); i != freeRects.end(); ++i)
+            if (adjacent(*i, freed))
+            {
+                left = std::min(left, i->left);
+                top = std::min(top, i->top);
+                right = std::max(right, i->left + i->width);
+                bottom = std::max(bottom, i->top + i->height);
+            }
+        Block area(left, top, right - left, bottom - top);
+
+        local.assign(1, area);
+        for (Blocks::const_iterator i = blocks.begin(); i != blocks.end(); ++i)
+            if (intersect(*i, area))
+                cut(local, *i, removed);
+        for (Blocks::const_iterator i = nestedBlocks.begin(); i != nestedBlocks.end(); ++i)
+            if (intersect(*i, area))
+                cut(local, *i, removed);
+        removed.clear();
+
+        // Drop the adjacent rectangles that have grown into a new one.
+        for (std::size_t i = 0; i < freeRects.size(); )
+        {
+            bool grown = false;
+            if (adjacent(freeRects[i], freed))
+                for (std::size_t j = 0; j < local.size() && !grown; ++j)
+                    grown = intersect(local[j], freed) && contains(local[j], freeRects[i]);
+            if (grown)
+                removeFreeRect(i);
+            else
+                ++i;
+        }
+        for (Blocks::const_iterator i = local.begin(); i != local.end(); ++i)
+            if (intersect(*i, freed))
+                addFreeRect(*i);
+        freeSizesStale = true;
+    }
 
-        // Test if the block collides with any existing rects.
-        Blocks::const_iterator i, end = blocks.end();
-        for (i = blocks.begin(); i != end; ++i)
-            if (i->left < right && block.left < i->left + i->width &&
-                i->top < bottom && block.top < i->top + i->height)
+    // Removes the block from the list, returning false if it is not in it.
+    static bool remove(Blocks& list, const Block& block)
+    {
+        for (Blocks::iterator i = list.begin(); i != list.end(); ++i)
+            if (i->left == block.left && i->top == block.top &&
+                i->width == block.width && i->height == block.height)
             {
-                return false;
+                *i = list.back();
+                list.pop_back();
+                return true;
             }
+        return false;
+    }
 
-        return true;
+    bool isCovered(const Block& block) const
+    {
+        for (Blocks::const_iterator i = blocks.begin(); i != blocks.end(); ++i)
+            if (contains(*i, block))
+                return true;
+        for (Blocks::const_iterator i = nestedBlocks.begin(); i != nestedBlocks.end(); ++i)
+            if (contains(*i, block))
+                return true;
+        return false;
     }
 };
 
@@ -51,11 +281,9 @@ Gosu::BlockAllocator::BlockAllocator(unsigned width, unsigned height)
     pimpl->width = width;
     pimpl->height = height;
 
-    pimpl->firstX = 0;
-    pimpl->firstY = 0;
-
-    pimpl->maxW = width;
-    pimpl->maxH = height;
+    pimpl->usedArea = 0;
+    pimpl->addFreeRect(Block(0, 0, width, height));
+    pimpl->freeSizesStale = true;
 }
 
 Gosu::BlockAllocator::~BlockAllocator()
@@ -72,71 +300,96 @@ unsigned Gosu::BlockAllocator::height() const
     return pimpl->height;
 }
 
+unsigned long Gosu::BlockAllocator::usedArea() const
+{
+    return pimpl->usedArea;
+}
+
+bool Gosu::BlockAllocator::mayFit(unsigned aWidth, unsigned aHeight) const
+{
+    if (aWidth > width() || aHeight > height())
+        return false;
+    if ((unsigned long)aWidth * aHeight > (unsigned long)width() * height() - usedArea())
+        return false;
+    if (pimpl->freeSizesStale)
+        return true;
+    return pimpl->fits(aWidth, aHeight);
+}
+
 bool Gosu::BlockAllocator::alloc(unsigned aWidth, unsigned aHeight, Block& b)
 {
+    TraceZone zone("BlockAllocator::alloc");
     // The rect wouldn't even fit onto the texture!
     if (aWidth > width() || aHeight > height())
         return false;
 
-    // We know there's no space left.
-    if (aWidth > pimpl->maxW && aHeight > pimpl->maxH)
+    // Skip the search if it is known to fail.
+    if (!pimpl->freeSizesStale && !pimpl->fits(aWidth, aHeight))
         return false;
-    
-    // Start to look for a place next to the last returned rect. Chances are
-    // good we'll find a place there.
-    b = Block(pimpl->firstX, pimpl->firstY, aWidth, aHeight);
-    if (pimpl->isBlockFree(b))
+
+    // Best short side fit: take the free rectangle that leaves the least
+    // room along one side, so that rows of similar blocks are packed
+    // tightly. Walking the rectangles by increasing room in width and in
+    // height at once meets them in the order of their short side, so the
+    // search can stop once that exceeds the best one's.
+    std::set<Block, ByWidth>::const_iterator byWidth =
+        pimpl->freeByWidth.lower_bound(Block(0, 0, aWidth, 0));
+    std::set<Block, ByHeight>::const_iterator byHeight =
+        pimpl->freeByHeight.lower_bound(Block(0, 0, 0, aHeight));
+    const Block* best = 0;
+    unsigned bestShortSide = UINT_MAX, bestLongSide = UINT_MAX;
+    for (;;)
     {
-        pimpl->markBlockUsed(b, aWidth, aHeight);
-        return true;
-    }
+        unsigned roomX = byWidth != pimpl->freeByWidth.end() ? byWidth->width - aWidth : UINT_MAX;
+        unsigned roomY = byHeight != pimpl->freeByHeight.end() ? byHeight->height - aHeight : UINT_MAX;
+        if (std::min(roomX, roomY) == UINT_MAX || std::min(roomX, roomY) > bestShortSide)
+            break;
+        const Block* i = roomX <= roomY ? &*byWidth++ : &*byHeight++;
+        if (i->width < aWidth || i->height < aHeight)
+            continue;
 
-    // Brute force: Look for a free place on this texture.
-    unsigned& x = b.left;
-    unsigned& y = b.top;
-    for (y = 0; y <= height() - aHeight; y += 16)
-        for (x = 0; x <= width() - aWidth; x += 8)
+        unsigned shortSide = std::min(i->width - aWidth, i->height - aHeight);
+        unsigned longSide = std::max(i->width - aWidth, i->height - aHeight);
+        if (shortSide < bestShortSide ||
+            (shortSide == bestShortSide && longSide < bestLongSide))
         {
-            if (!pimpl->isBlockFree(b))
-                continue;
-
-            // Found a nice place!
-
-            // Try to make up for the large for()-stepping.
-            while (y > 0 && pimpl->isBlockFree(Block(x, y - 1, aWidth, aHeight)))
-                --y;
-            while (x > 0 && pimpl->isBlockFree(Block(x - 1, y, aWidth, aHeight)))
-                --x;
-            
-            pimpl->markBlockUsed(b, aWidth, aHeight);
-            return true;
+            best = i;
+            bestShortSide = shortSide;
+            bestLongSide = longSide;
+            if (longSide == 0)
+                break;
         }
+    }
+    if (!best)
+    {
+        pimpl->updateFreeSizes();
+        return false;
+    }
 
-    // So there was no space for the bitmap. Remember this for later.
-    pimpl->maxW = aWidth - 1;
-    pimpl->maxH = aHeight - 1;
-    return false;
+    b = Block(best->left, best->top, aWidth, aHeight);
+    pimpl->blocks.push_back(b);
+    pimpl->usedArea += aWidth * aHeight;
+    pimpl->occupy(b);
+    return true;
 }
 
 void Gosu::BlockAllocator::block(unsigned left, unsigned top, unsigned width, unsigned height)
 {
-    pimpl->blocks.push_back(Block(left, top, width, height));
+    Block b(left, top, width, height);
+    pimpl->nestedBlocks.push_back(b);
+    pimpl->occupy(b);
 }
 
 void Gosu::BlockAllocator::free(unsigned left, unsigned top, unsigned width, unsigned height)
 {
-    for (Impl::Blocks::iterator i = pimpl->blocks.begin();
-        i != pimpl->blocks.end(); ++i)
-    {
-        if (i->left == left && i->top == top && i->width == width && i->height == height)
-        {
-            pimpl->blocks.erase(i);
-			// Be optimistic again!
-            pimpl->maxW = pimpl->width - 1;
-            pimpl->maxH = pimpl->height - 1;
-            return;
-        }
-    }
+    Block freed(left, top, width, height);
+    if (Impl::remove(pimpl->blocks, freed))
+        pimpl->usedArea -= width * height;
+    else if (!Impl::remove(pimpl->nestedBlocks, freed))
+        throw std::logic_error("Tried to free an invalid block");
 
-    throw std::logic_error("Tried to free an invalid block");
+    // Blocks of subimages lie within the blocks of their parents; nothing
+    // becomes free when they go away first.
+    if (freed.width != 0 && freed.height != 0 && !pimpl->isCovered(freed))
+        pimpl->release(freed);
 }
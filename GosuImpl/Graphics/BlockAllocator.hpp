@@ -24,6 +24,11 @@ namespace Gosu
 
         unsigned width() const;
         unsigned height() const;
+        // Total area of the blocks returned by alloc that are still in use.
+        unsigned long usedArea() const;
+        // Returns false if alloc would fail, without searching. May return
+        // true in vain right after a block was freed.
+        bool mayFit(unsigned width, unsigned height) const;
 
         bool alloc(unsigned width, unsigned height, Block& block);
         void block(unsigned left, unsigned top, unsigned width, unsigned height);
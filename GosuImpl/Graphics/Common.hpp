@@ -28,6 +28,7 @@ namespace Gosu
 {
     struct RenderState;
     class RenderStateManager;
+    class RenderStateTable;
 
     const GLuint NO_TEXTURE = static_cast<GLuint>(-1);
     const unsigned NO_CLIPPING = 0xffffffff;
@@ -55,8 +56,14 @@ namespace Gosu
     class ClipRectStack;
     struct DrawOp;
     class DrawOpQueue;
-    typedef std::list<Transform> Transforms;
+    class RenderThread;
+    class UploadThread;
+    class FrameHash;
     typedef std::list<DrawOpQueue> DrawOpQueueStack;
+    // The queue that the calling thread currently draws into: its recording
+    // context's queue if it has attached to one, else queues.back().
+    DrawOpQueue& currentQueue(DrawOpQueueStack& queues);
+    DrawOpQueue& currentQueue(Graphics& graphics);
     class Macro;
     struct ArrayVertex
     {
@@ -6,17 +6,19 @@
 #include "Common.hpp"
 #include "RenderState.hpp"
 #include "TexChunk.hpp"
+#include <algorithm>
 #include <cassert>
 
 namespace Gosu
 {
+    // Kept as small as possible because the queue may hold hundreds of
+    // thousands of these. The Z position is stored by the queue's sorter.
     struct DrawOp
     {
-        // For sorting before drawing the queue.
-        ZPos z;
+        // Index into the RenderStateTable of the queue this op was scheduled in.
+        unsigned renderStateIndex;
         
-        RenderState renderState;
-        // Only valid if renderState.texName != NO_TEXTURE
+        // Only valid if the render state has a texture.
         GLfloat top, left, bottom, right;
         
         // TODO: Merge with Gosu::ArrayVertex.
@@ -32,13 +34,12 @@ namespace Gosu
         // Number of vertices used, or: complement index of code block
         int verticesOrBlockIndex;
         
-        void perform(const DrawOp* next) const
+        #ifdef GOSU_IS_IPHONE
+        void perform(const RenderState& renderState, const DrawOp* next) const
         {
             // This should not be called on GL code ops.
-            assert (verticesOrBlockIndex >= 2);
-            assert (verticesOrBlockIndex <= 4);
+            assert (verticesOrBlockIndex == 4);
             
-            #ifdef GOSU_IS_IPHONE
             static const unsigned MAX_AUTOGROUP = 24;
             
             static int spriteCounter = 0;
@@ -61,9 +62,7 @@ namespace Gosu
                 
                 isSetup = true;
             }
-            #endif
             
-            #ifdef GOSU_IS_IPHONE
             if (renderState.texture)
             {
                 spriteTexcoords[spriteCounter*12 + 0] = left;
@@ -80,40 +79,7 @@ namespace Gosu
                 spriteTexcoords[spriteCounter*12 + 10] = right;
                 spriteTexcoords[spriteCounter*12 + 11] = bottom;
             }
-            #endif
-            
-            #ifndef GOSU_IS_IPHONE
-            if (verticesOrBlockIndex == 2)
-                glBegin(GL_LINES);
-            else if (verticesOrBlockIndex == 3)
-                glBegin(GL_TRIANGLES);
-            else // if (verticesOrBlockIndex == 4)
-                glBegin(GL_QUADS);
             
-            for (unsigned i = 0; i < verticesOrBlockIndex; i++)
-            {
-                glColor4ubv(reinterpret_cast<const GLubyte*>(&vertices[i].c));
-                if (renderState.texture)
-                    switch (i)
-                    {
-                    case 0:
-                        glTexCoord2f(left, top);
-                        break;
-                    case 1:
-                        glTexCoord2f(right, top);
-                        break;
-                    case 2:
-                        glTexCoord2f(right, bottom);
-                        break;
-                    case 3:
-                        glTexCoord2f(left, bottom);
-                        break;
-                    }
-                glVertex2f(vertices[i].x, vertices[i].y);
-            }
-            
-            glEnd();
-            #else
             for (int i = 0; i < 3; ++i)
             {
                 spriteVertices[spriteCounter*12 + i*2] = vertices[i].x;
@@ -128,50 +94,76 @@ namespace Gosu
             }
             
             ++spriteCounter;
-            if (spriteCounter == MAX_AUTOGROUP || next == 0 || !(next->renderState == renderState))
+            if (spriteCounter == MAX_AUTOGROUP || next == 0 || next->renderStateIndex != renderStateIndex)
             {
                 glDrawArrays(GL_TRIANGLES, 0, 6 * spriteCounter);
                 //if (spriteCounter > 1)
                 //    printf("grouped %d quads\n", spriteCounter);
                 spriteCounter = 0;
             }
-            #endif
         }
-        
-        void compileTo(VertexArrays& vas) const
+        #else
+        // Writes the vertices of this op to a batch that is drawn with a
+        // single glDrawArrays call by DrawOpQueue. The result usually points
+        // into a mapped vertex buffer, which is write-combined memory on many
+        // systems, so every vertex is written completely and in order.
+        void writeTo(const RenderState& renderState, ArrayVertex* result) const
         {
-            // Copy vertex data and apply & forget about the transform.
-            // This is important because the pointed-to transform will be gone by the next
-            // frame anyway.
-            ArrayVertex result[4];
-            for (int i = 0; i < 4; ++i)
+            // This should not be called on GL code ops.
+            assert (verticesOrBlockIndex >= 2);
+            assert (verticesOrBlockIndex <= 4);
+            
+            GLfloat u[4] = { 0, 0, 0, 0 }, v[4] = { 0, 0, 0, 0 };
+            if (renderState.texture)
             {
+                u[0] = left, u[1] = right, u[2] = right, u[3] = left;
+                v[0] = top, v[1] = top, v[2] = bottom, v[3] = bottom;
+            }
+            
+            for (int i = 0; i < verticesOrBlockIndex; ++i)
+            {
+                result[i].texCoords[0] = u[i];
+                result[i].texCoords[1] = v[i];
+                result[i].color = vertices[i].c.abgr();
                 result[i].vertices[0] = vertices[i].x;
                 result[i].vertices[1] = vertices[i].y;
                 result[i].vertices[2] = 0;
-                result[i].color = vertices[i].c.abgr();
+            }
+        }
+        
+        GLenum primitive() const
+        {
+            if (verticesOrBlockIndex == 2)
+                return GL_LINES;
+            else if (verticesOrBlockIndex == 3)
+                return GL_TRIANGLES;
+            else // if (verticesOrBlockIndex == 4)
+                return GL_QUADS;
+        }
+        #endif
+        
+        // Writes a quad with the transform applied, because the pointed-to
+        // transform will be gone by the next frame anyway. Triangles repeat
+        // their last vertex; lines end up with no area.
+        void compileTo(const RenderState& renderState, ArrayVertex* result) const
+        {
+            assert (verticesOrBlockIndex >= 2);
+            assert (verticesOrBlockIndex <= 4);
+            
+            for (int i = 0; i < 4; ++i)
+            {
+                const Vertex& vertex = vertices[std::min(i, verticesOrBlockIndex - 1)];
+                result[i].vertices[0] = vertex.x;
+                result[i].vertices[1] = vertex.y;
+                result[i].vertices[2] = 0;
+                result[i].color = vertex.c.abgr();
                 applyTransform(*renderState.transform, result[i].vertices[0], result[i].vertices[1]);
             }
-            RenderState vaRenderState = renderState;
-            vaRenderState.transform = 0;
             
             result[0].texCoords[0] = left, result[0].texCoords[1] = top;
             result[1].texCoords[0] = right, result[1].texCoords[1] = top;
             result[2].texCoords[0] = right, result[2].texCoords[1] = bottom;
             result[3].texCoords[0] = left, result[3].texCoords[1] = bottom;
-            
-            if (vas.empty() || !(vas.back().renderState == vaRenderState))
-            {
-                vas.push_back(VertexArray());
-                vas.back().renderState = vaRenderState;
-            }
-            
-            vas.back().vertices.insert(vas.back().vertices.end(), result, result + 4);
-        }
-        
-        bool operator<(const DrawOp& other) const
-        {
-            return z < other.z;
         }
     };
 }
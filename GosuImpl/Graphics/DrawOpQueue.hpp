@@ -6,6 +6,13 @@
 #include "TransformStack.hpp"
 #include "ClipRectStack.hpp"
 #include "DrawOp.hpp"
+#include "DrawOpSorter.hpp"
+#include "FrameArena.hpp"
+#include "FrameHash.hpp"
+#include "GPUTimer.hpp"
+#include "StreamingBuffer.hpp"
+#include <Gosu/Inspection.hpp>
+#include <Gosu/Timing.hpp>
 #include <cassert>
 #include <algorithm>
 #include <map>
@@ -17,44 +24,359 @@ class Gosu::DrawOpQueue
     TransformStack transformStack;
     ClipRectStack clipRectStack;
 
-    typedef std::vector<DrawOp> DrawOps;
-    DrawOps ops;
-    typedef std::vector<std::tr1::function<void()> > GLBlocks;
-    GLBlocks glBlocks;
+    // Ops and GL blocks live in the arena until the queue is cleared, so
+    // steady-state frames do not touch the heap.
+    FrameArena arena;
+    ArenaSequence<DrawOp> ops;
+    DrawOpSorter sorter;
+    RenderStateTable renderStates;
+    
+    struct GLBlock
+    {
+        void (*invoke)(void*);
+        void* functor;
+        // See Graphics::scheduleGL; 0 if unknown.
+        std::tr1::uint64_t identity;
+    };
+    std::vector<GLBlock> glBlocks;
+    
+    template<typename Functor>
+    static void invokeFunctor(void* functor)
+    {
+        (*static_cast<Functor*>(functor))();
+    }
+    
+    // Ops that end up completely outside of the viewport or the current clip
+    // rect are dropped right away. Only the screen's queue knows its viewport;
+    // macros can be drawn anywhere later.
+    bool culling;
+    double viewportWidth, viewportHeight;
+    unsigned culled;
+    
+    // If enabled, vertices are transformed on the CPU when they are scheduled.
+    // All such ops then share the identity transform and can be batched even
+    // if they were drawn with different transforms.
+    bool preTransform;
+    Transform identity;
+    
+    // Projective transforms are left to OpenGL; points could end up behind the
+    // viewer and need to be clipped properly.
+    static bool isAffine(const Transform& transform)
+    {
+        return transform[3] == 0 && transform[7] == 0 && transform[15] == 1;
+    }
+    
+    bool isInvisible(const DrawOp& op, const Transform& transform) const
+    {
+        if (!isAffine(transform))
+            return false;
+        
+        double minX = 0, maxX = 0, minY = 0, maxY = 0;
+        for (int i = 0; i < op.verticesOrBlockIndex; ++i)
+        {
+            double x = op.vertices[i].x, y = op.vertices[i].y;
+            if (&transform != &identity)
+                applyTransform(transform, x, y);
+            if (i == 0)
+                minX = maxX = x, minY = maxY = y;
+            else
+            {
+                minX = std::min(minX, x), maxX = std::max(maxX, x);
+                minY = std::min(minY, y), maxY = std::max(maxY, y);
+            }
+        }
+        
+        // Leave a pixel of room for lines and points, which GL rasterizes
+        // with a width even though their bounding box may be empty.
+        const double MARGIN = 1;
+        double left = -MARGIN, right = viewportWidth + MARGIN;
+        double top = -MARGIN, bottom = viewportHeight + MARGIN;
+        if (const ClipRect* rect = clipRectStack.maybeEffectiveRect())
+        {
+            // Clip rects are stored the way glScissor wants them.
+            double fac = clipRectBaseFactor();
+            left = std::max(left, rect->x / fac - MARGIN);
+            right = std::min(right, (rect->x + rect->width) / fac + MARGIN);
+            top = std::max(top, viewportHeight - (rect->y + rect->height) / fac - MARGIN);
+            bottom = std::min(bottom, viewportHeight - rect->y / fac + MARGIN);
+        }
+        
+        return maxX < left || minX > right || maxY < top || minY > bottom;
+    }
+    
+    static void transformVertices(DrawOp& op, const Transform& transform)
+    {
+        for (int i = 0; i < op.verticesOrBlockIndex; ++i)
+        {
+            double x = op.vertices[i].x, y = op.vertices[i].y;
+            applyTransform(transform, x, y);
+            op.vertices[i].x = x, op.vertices[i].y = y;
+        }
+    }
+    
+    void push(const DrawOp& op, ZPos z)
+    {
+        ops.push_back(arena, op);
+        sorter.addKey(z);
+        vertexCount += op.verticesOrBlockIndex;
+    }
+    
+    // Sum of the vertices of all ops, i.e. what performDrawOpsAndCode streams.
+    std::size_t vertexCount;
+    
+    const DrawOpSorter::Order& sortOps()
+    {
+        TraceZone zone("DrawOpQueue::sort");
+        return sorter.sort();
+    }
+    
+    #ifndef GOSU_IS_IPHONE
+    // Consecutive ops that share the same render state and primitive type,
+    // drawn with a single glDrawArrays call; or a GL block. Kept around so
+    // that its capacity is reused between frames.
+    struct Batch
+    {
+        unsigned renderStateIndex;
+        GLenum primitive;
+        GLint first;
+        // Number of vertices, or: complement index of code block
+        int countOrBlockIndex;
+    };
+    std::vector<Batch> batches;
+    #endif
+
+    // How many vertex arrays a quad may skip to join an earlier one.
+    static const std::size_t MACRO_LOOKBACK = 8;
+
+    // A quad can join an earlier array with the same texture and alpha mode
+    // as long as it does not overlap any array that comes after that one.
+    static void appendQuad(VertexArrays& vas, const RenderState& state, const ArrayVertex* quad)
+    {
+        GLfloat left = quad[0].vertices[0], right = left;
+        GLfloat top = quad[0].vertices[1], bottom = top;
+        for (int i = 1; i < 4; ++i)
+        {
+            left = std::min(left, quad[i].vertices[0]);
+            right = std::max(right, quad[i].vertices[0]);
+            top = std::min(top, quad[i].vertices[1]);
+            bottom = std::max(bottom, quad[i].vertices[1]);
+        }
+
+        std::size_t target = vas.size();
+        for (std::size_t i = vas.size(); i > 0 && vas.size() - i < MACRO_LOOKBACK; --i)
+        {
+            const VertexArray& va = vas[i - 1];
+            if (va.renderState.texture == state.texture && va.renderState.mode == state.mode)
+            {
+                target = i - 1;
+                break;
+            }
+            if (va.left < right && left < va.right && va.top < bottom && top < va.bottom)
+                break;
+        }
+
+        if (target == vas.size())
+        {
+            // Macros are drawn with their own transform and no clipping yet.
+            vas.push_back(VertexArray());
+            vas.back().renderState.texture = state.texture;
+            vas.back().renderState.mode = state.mode;
+            vas.back().left = left, vas.back().right = right;
+            vas.back().top = top, vas.back().bottom = bottom;
+        }
+
+        VertexArray& va = vas[target];
+        va.vertices.insert(va.vertices.end(), quad, quad + 4);
+        va.left = std::min(va.left, left), va.right = std::max(va.right, right);
+        va.top = std::min(va.top, top), va.bottom = std::max(va.bottom, bottom);
+    }
 
 public:
-    void scheduleDrawOp(DrawOp op)
+    DrawOpQueue()
+    : culling(false), viewportWidth(0), viewportHeight(0), culled(0),
+      preTransform(false), identity(scale(1)), vertexCount(0)
+    {
+    }
+    
+    void setPreTransform(bool enabled)
+    {
+        preTransform = enabled;
+    }
+    
+    // Takes over the base transform, culling and pre-transformation settings
+    // of another queue. Must be called right after reset().
+    void configureLike(const DrawOpQueue& other)
+    {
+        transformStack.setBaseTransform(other.transformStack.base());
+        culling = other.culling;
+        viewportWidth = other.viewportWidth;
+        viewportHeight = other.viewportHeight;
+        preTransform = other.preTransform;
+    }
+    
+    // Like configureLike, but also takes over the current stacks of
+    // transforms and clippings, so that drawing can continue in this queue.
+    void continueFrom(const DrawOpQueue& other)
+    {
+        reset();
+        configureLike(other);
+        transformStack.continueFrom(other.transformStack);
+        clipRectStack = other.clipRectStack;
+    }
+    
+    bool empty() const
+    {
+        return ops.empty();
+    }
+    
+    // Enables culling against a viewport of the given physical size.
+    void enableCulling(double width, double height)
+    {
+        culling = true;
+        viewportWidth = width;
+        viewportHeight = height;
+    }
+    
+    // Number of ops that were culled since the last clearQueue().
+    unsigned culledOps() const
+    {
+        return culled;
+    }
+    
+    // Number of queued ops, not counting GL blocks.
+    unsigned drawOps() const
+    {
+        return ops.size() - glBlocks.size();
+    }
+    
+    // Arena memory taken up since the queue was last cleared, and the chunks
+    // that the arena had to allocate for it.
+    std::size_t arenaBytes() const
+    {
+        return arena.used();
+    }
+    
+    unsigned arenaAllocations() const
+    {
+        return arena.allocations();
+    }
+    
+    void scheduleDrawOp(DrawOp op, ZPos z, const std::tr1::shared_ptr<Texture>& texture,
+        AlphaMode mode)
     {
         if (clipRectStack.clippedWorldAway())
             return;
+        
+        const Transform* transform = &transformStack.current();
+        if (preTransform && isAffine(*transform))
+        {
+            transformVertices(op, *transform);
+            transform = &identity;
+        }
+        
+        if (culling && isInvisible(op, *transform))
+        {
+            ++culled;
+            return;
+        }
 
         #ifdef GOSU_IS_IPHONE
         // No triangles, no lines supported
         assert (op.verticesOrBlockIndex == 4);
         #endif
 
-        op.renderState.transform = &transformStack.current();
-        if (const ClipRect* cr = clipRectStack.maybeEffectiveRect())
-            op.renderState.clipRect = *cr;
-        ops.push_back(op);
+        op.renderStateIndex = renderStates.intern(texture, transform,
+            clipRectStack.maybeEffectiveRect(), mode);
+        push(op, z);
+    }
+    
+    // Schedules count quads of the given size that only differ in position,
+    // scale, angle and color (see Image::drawSprites). The prototype provides
+    // the texture coordinates. All of them share a single render state.
+    void scheduleSprites(const DrawOp& prototype, float width, float height,
+        std::size_t count, const float* x, const float* y,
+        const float* scales, const float* angles, const Color* colors,
+        ZPos z, const std::tr1::shared_ptr<Texture>& texture, AlphaMode mode)
+    {
+        if (clipRectStack.clippedWorldAway())
+            return;
+        
+        const Transform* transform = &transformStack.current();
+        bool transformEach = preTransform && isAffine(*transform);
+        DrawOp op = prototype;
+        op.verticesOrBlockIndex = 4;
+        op.renderStateIndex = renderStates.intern(texture,
+            transformEach ? &identity : transform, clipRectStack.maybeEffectiveRect(), mode);
+        
+        // The half extents of each sprite are computed in blocks from the
+        // input arrays, in a loop without dependencies between iterations
+        // that the compiler can vectorize.
+        const std::size_t BLOCK_SIZE = 256;
+        float rightX[BLOCK_SIZE], rightY[BLOCK_SIZE], upX[BLOCK_SIZE], upY[BLOCK_SIZE];
+        const float DEG_TO_RAD = 3.14159265358979f / 180;
+        
+        for (std::size_t start = 0; start < count; start += BLOCK_SIZE)
+        {
+            std::size_t blockSize = std::min(BLOCK_SIZE, count - start);
+            
+            for (std::size_t i = 0; i < blockSize; ++i)
+            {
+                float scale = scales ? scales[start + i] : 1.f;
+                float radians = angles ? angles[start + i] * DEG_TO_RAD : 0.f;
+                float cosine = std::cos(radians), sine = std::sin(radians);
+                // Gosu angles are clockwise from the top; see offsetX/offsetY.
+                rightX[i] = cosine * width * scale / 2;
+                rightY[i] = sine * width * scale / 2;
+                upX[i] = sine * height * scale / 2;
+                upY[i] = -cosine * height * scale / 2;
+            }
+            
+            for (std::size_t i = 0; i < blockSize; ++i)
+            {
+                float cx = x[start + i], cy = y[start + i];
+                Color c = colors ? colors[start + i] : Color::WHITE;
+                op.vertices[0] = DrawOp::Vertex(cx - rightX[i] + upX[i], cy - rightY[i] + upY[i], c);
+                op.vertices[1] = DrawOp::Vertex(cx + rightX[i] + upX[i], cy + rightY[i] + upY[i], c);
+                // See TexChunk::draw.
+                #ifdef GOSU_IS_IPHONE
+                op.vertices[2] = DrawOp::Vertex(cx - rightX[i] - upX[i], cy - rightY[i] - upY[i], c);
+                op.vertices[3] = DrawOp::Vertex(cx + rightX[i] - upX[i], cy + rightY[i] - upY[i], c);
+                #else
+                op.vertices[3] = DrawOp::Vertex(cx - rightX[i] - upX[i], cy - rightY[i] - upY[i], c);
+                op.vertices[2] = DrawOp::Vertex(cx + rightX[i] - upX[i], cy + rightY[i] - upY[i], c);
+                #endif
+                
+                if (transformEach)
+                    transformVertices(op, *transform);
+                if (culling && isInvisible(op, transformEach ? identity : *transform))
+                {
+                    ++culled;
+                    continue;
+                }
+                push(op, z);
+            }
+        }
     }
 
-    void scheduleGL(std::tr1::function<void()> glBlock, ZPos z)
+    // Copies the functor into the frame arena; it is destroyed when the queue
+    // is cleared.
+    template<typename Functor>
+    void scheduleGL(const Functor& functor, ZPos z, std::tr1::uint64_t identity = 0)
     {
         // TODO: Document this case: Clipped-away GL blocks are *not* being run.
         if (clipRectStack.clippedWorldAway())
             return;
 
         int complementOfBlockIndex = ~(int)glBlocks.size();
+        GLBlock glBlock = { &invokeFunctor<Functor>, arena.create(functor), identity };
         glBlocks.push_back(glBlock);
 
         DrawOp op;
         op.verticesOrBlockIndex = complementOfBlockIndex;
-        op.renderState.transform = &transformStack.current();
-        if (const ClipRect* cr = clipRectStack.maybeEffectiveRect())
-            op.renderState.clipRect = *cr;
-        op.z = z;
-        ops.push_back(op);
+        op.renderStateIndex = renderStates.intern(std::tr1::shared_ptr<Texture>(),
+            &transformStack.current(), clipRectStack.maybeEffectiveRect(), amDefault);
+        ops.push_back(arena, op);
+        sorter.addKey(z);
     }
 
     void beginClipping(double x, double y, double width, double height, double screenHeight)
@@ -100,61 +422,236 @@ public:
         transformStack.pop();
     }
 
-    void performDrawOpsAndCode()
+    // The vertex buffer and GPU timer belong to the GL context that this is
+    // called on. Adds what it took to the stats.
+    void performDrawOpsAndCode(StreamingBuffer& vertexBuffer, GPUTimer& gpuTimer,
+        FrameStats& stats)
     {
+        TraceZone zone("DrawOpQueue::perform");
+        GPUTimer::Section gpuSection(gpuTimer, GPUTimer::gpSubmission);
+        std::tr1::uint64_t startTime = nanoseconds();
+        
         // Apply Z-Ordering.
-        std::stable_sort(ops.begin(), ops.end());
+        const DrawOpSorter::Order& order = sortOps();
+        stats.sortTime += (nanoseconds() - startTime) / 1000000.0;
 
-        RenderStateManager manager;
+        RenderStateManager manager(stats);
         #ifdef GOSU_IS_IPHONE
         if (ops.empty())
             return;
 
-        DrawOps::const_iterator current = ops.begin(), last = ops.end() - 1;
-        for (; current != last; ++current)
+        for (std::size_t i = 0, last = order.size() - 1; i < last; ++i)
         {
-            manager.setRenderState(current->renderState);
-            current->perform(&*(current + 1));
+            const DrawOp& op = ops[order[i]];
+            manager.setRenderState(renderStates[op.renderStateIndex]);
+            op.perform(renderStates[op.renderStateIndex], &ops[order[i + 1]]);
         }
-        manager.setRenderState(last->renderState);
-        last->perform(0);
+        const DrawOp& lastOp = ops[order.back()];
+        manager.setRenderState(renderStates[lastOp.renderStateIndex]);
+        lastOp.perform(renderStates[lastOp.renderStateIndex], 0);
         #else
-        for (DrawOps::const_iterator current = ops.begin(), last = ops.end();
-            current != last; ++current)
+        // First write all vertices in Z order and find out where batches
+        // start; nothing can be drawn while the vertex buffer is mapped.
+        ArrayVertex* vertices = vertexCount ? vertexBuffer.map(vertexCount) : 0;
+        std::size_t written = 0;
+        batches.clear();
+        for (DrawOpSorter::Order::const_iterator index = order.begin(), end = order.end();
+            index != end; ++index)
+        {
+            const DrawOp& op = ops[*index];
+            if (op.verticesOrBlockIndex >= 0)
+            {
+                // Start a new batch unless this op can be drawn along with the
+                // previous ones.
+                if (batches.empty() || batches.back().countOrBlockIndex < 0 ||
+                    batches.back().renderStateIndex != op.renderStateIndex ||
+                    batches.back().primitive != op.primitive())
+                {
+                    Batch batch = { op.renderStateIndex, op.primitive(), static_cast<GLint>(written), 0 };
+                    batches.push_back(batch);
+                }
+                op.writeTo(renderStates[op.renderStateIndex], vertices + written);
+                written += op.verticesOrBlockIndex;
+                batches.back().countOrBlockIndex += op.verticesOrBlockIndex;
+            }
+            else
+            {
+                Batch batch = { op.renderStateIndex, 0, 0, op.verticesOrBlockIndex };
+                batches.push_back(batch);
+            }
+        }
+        assert (written == vertexCount);
+        const GLvoid* base = vertexCount ? vertexBuffer.unmap() : 0;
+        // If a GL block throws, the next map() must still wait for the GPU
+        // to be done with these vertices.
+        StreamingBuffer::Release release(vertexCount ? &vertexBuffer : 0);
+        
+        bool arraysSet = false;
+        for (std::vector<Batch>::const_iterator batch = batches.begin(), end = batches.end();
+            batch != end; ++batch)
         {
-            manager.setRenderState(current->renderState);
-            if (current->verticesOrBlockIndex >= 0)
-                current->perform(0);
+            manager.setRenderState(renderStates[batch->renderStateIndex]);
+            if (batch->countOrBlockIndex >= 0)
+            {
+                if (!arraysSet)
+                {
+                    vertexBuffer.bind();
+                    glInterleavedArrays(GL_T2F_C4UB_V3F, 0, base);
+                    arraysSet = true;
+                }
+                glDrawArrays(batch->primitive, batch->first, batch->countOrBlockIndex);
+                ++stats.batches;
+            }
             else
             {
-                // GL code
-                int blockIndex = ~current->verticesOrBlockIndex;
+                // GL code, which may use client arrays and bind buffers itself.
+                if (arraysSet)
+                {
+                    vertexBuffer.unbind();
+                    arraysSet = false;
+                }
+                int blockIndex = ~batch->countOrBlockIndex;
                 assert (blockIndex >= 0);
                 assert (blockIndex < glBlocks.size());
-                glBlocks[blockIndex]();
+                {
+                    GPUTimer::Section blockSection(gpuTimer, GPUTimer::gpGLBlocks);
+                    glBlocks[blockIndex].invoke(glBlocks[blockIndex].functor);
+                }
                 manager.enforceAfterUntrustedGL();
+                ++stats.glBlocks;
             }
         }
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
         #endif
+        
+        stats.submitTime += (nanoseconds() - startTime) / 1000000.0;
+    }
+
+    // Whether performDrawOpsAndCode may sample from the texture. GL blocks,
+    // such as macros, can draw from anything.
+    bool mayRead(GLuint texName) const
+    {
+        if (!glBlocks.empty())
+            return true;
+        for (unsigned i = 0; i < renderStates.size(); ++i)
+            if (renderStates[i].texture && renderStates[i].texture->texName() == texName)
+                return true;
+        return false;
+    }
+
+    // Adds everything that performDrawOpsAndCode's result depends on to the
+    // hash. Returns false if that is not known, because of a GL block
+    // without an identity.
+    bool hashInto(FrameHash& hash)
+    {
+        for (unsigned i = 0; i < renderStates.size(); ++i)
+        {
+            const RenderState& state = renderStates[i];
+            hash.add(state.texture.get());
+            hash.add(state.texture ? state.texture->revision() : 0);
+            for (int j = 0; j < 16; ++j)
+                hash.add((*state.transform)[j]);
+            hash.add(state.clipRect.width);
+            if (state.clipRect.width != NO_CLIPPING)
+            {
+                hash.add(state.clipRect.x), hash.add(state.clipRect.y);
+                hash.add(state.clipRect.height);
+            }
+            hash.add(std::tr1::uint64_t(state.mode));
+        }
+        
+        const DrawOpSorter::Order& order = sorter.sort();
+        for (DrawOpSorter::Order::const_iterator index = order.begin(), end = order.end();
+            index != end; ++index)
+        {
+            const DrawOp& op = ops[*index];
+            hash.add(std::tr1::uint64_t(op.renderStateIndex) << 32 | unsigned(op.verticesOrBlockIndex));
+            if (op.verticesOrBlockIndex < 0)
+            {
+                std::tr1::uint64_t identity = glBlocks[~op.verticesOrBlockIndex].identity;
+                if (identity == 0)
+                    return false;
+                hash.add(identity);
+                continue;
+            }
+            
+            for (int i = 0; i < op.verticesOrBlockIndex; ++i)
+            {
+                hash.add(op.vertices[i].x), hash.add(op.vertices[i].y);
+                hash.add(std::tr1::uint64_t(op.vertices[i].c.argb()));
+            }
+            if (renderStates[op.renderStateIndex].texture)
+            {
+                hash.add(op.left), hash.add(op.top);
+                hash.add(op.right), hash.add(op.bottom);
+            }
+        }
+        return true;
     }
 
+    // Turns the queue into as few vertex arrays as possible, without
+    // changing which quad is drawn over which.
     void compileTo(VertexArrays& vas)
     {
         if (!glBlocks.empty())
             throw std::logic_error("Custom code cannot be recorded into a macro");
 
-        std::stable_sort(ops.begin(), ops.end());
-        for (DrawOps::const_iterator op = ops.begin(), end = ops.end(); op != end; ++op)
-            op->compileTo(vas);
+        const DrawOpSorter::Order& order = sorter.sort();
+        for (DrawOpSorter::Order::const_iterator index = order.begin(), end = order.end();
+            index != end; ++index)
+        {
+            const DrawOp& op = ops[*index];
+            ArrayVertex quad[4];
+            op.compileTo(renderStates[op.renderStateIndex], quad);
+            appendQuad(vas, renderStates[op.renderStateIndex], quad);
+        }
     }
 
+    // Appends all ops of another queue. In case of equal Z, they come after
+    // this queue's ops, and in the order in which they were scheduled.
+    // The other queue owns the transforms and GL blocks that the ops refer
+    // to, so it must not be cleared before this queue.
+    void mergeFrom(DrawOpQueue& other)
+    {
+        for (std::size_t i = 0, n = other.ops.size(); i < n; ++i)
+        {
+            DrawOp op = other.ops[i];
+            
+            const RenderState& state = other.renderStates[op.renderStateIndex];
+            const Transform* transform =
+                state.transform == &other.identity ? &identity : state.transform;
+            const ClipRect* clipRect = state.clipRect.width == NO_CLIPPING ? 0 : &state.clipRect;
+            op.renderStateIndex = renderStates.intern(state.texture, transform, clipRect, state.mode);
+            
+            if (op.verticesOrBlockIndex < 0)
+            {
+                glBlocks.push_back(other.glBlocks[~op.verticesOrBlockIndex]);
+                op.verticesOrBlockIndex = ~(int)(glBlocks.size() - 1);
+            }
+            
+            ops.push_back(arena, op);
+        }
+        sorter.append(other.sorter);
+        vertexCount += other.vertexCount;
+        
+        culled += other.culled;
+        other.culled = 0;
+    }
+    
     // This retains the current stack of transforms and clippings.
     void clearQueue()
     {
         glBlocks.clear();
         ops.clear();
+        arena.reset();
+        sorter.clear();
+        renderStates.clear();
+        culled = 0;
+        vertexCount = 0;
     }
-
+    
     // This clears the queue and starts with new stacks. This must not be called
     // when endClipping/popTransform calls might still be pending.
     void reset()
@@ -165,4 +662,45 @@ public:
     }
 };
 
+#ifndef GOSU_IS_IPHONE
+namespace Gosu
+{
+    // Runs a scheduled GL functor between what beginGL and endGL would do.
+    template<typename Functor>
+    struct RunGLFunctor
+    {
+        Graphics& graphics;
+        Functor functor;
+        
+        RunGLFunctor(Graphics& graphics, const Functor& functor)
+        : graphics(graphics), functor(functor)
+        {
+        }
+        
+        void operator()() const
+        {
+            // Inlined beginGL() to avoid flushing.
+            glPushAttrib(GL_ALL_ATTRIB_BITS);
+            glDisable(GL_BLEND);
+            while (glGetError() != GL_NO_ERROR);
+            
+            functor();
+            
+            // Does not have to be inlined.
+            graphics.endGL();
+        }
+    };
+    
+    // Same as Graphics::scheduleGL, but the functor is copied into the
+    // frame arena as it is. Wrapping it into a std::tr1::function would
+    // allocate if it holds more than a few pointers.
+    template<typename Functor>
+    void scheduleGL(Graphics& graphics, const Functor& functor, ZPos z,
+        std::tr1::uint64_t identity = 0)
+    {
+        currentQueue(graphics).scheduleGL(RunGLFunctor<Functor>(graphics, functor), z, identity);
+    }
+}
+#endif
+
 #endif
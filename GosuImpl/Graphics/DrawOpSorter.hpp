@@ -0,0 +1,236 @@
+#ifndef GOSUIMPL_GRAPHICS_DRAWOPSORTER_HPP
+#define GOSUIMPL_GRAPHICS_DRAWOPSORTER_HPP
+
+#include <Gosu/GraphicsBase.hpp>
+#include <Gosu/TR1.hpp>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace Gosu
+{
+    // Computes the order in which the ops of a DrawOpQueue have to be performed.
+    // The result is equivalent to a std::stable_sort by Z, but only compact
+    // (key, index) pairs are moved around instead of the ops themselves.
+    // All buffers are kept between frames so that their capacity can be reused.
+    class DrawOpSorter
+    {
+    public:
+        typedef std::tr1::uint64_t Key;
+        typedef std::vector<unsigned> Order;
+
+    private:
+        struct Entry
+        {
+            Key key;
+            unsigned index;
+        };
+
+        std::vector<Key> keys;
+        Order order, lastOrder;
+        // Whether order belongs to the current keys, so that sorting twice
+        // in a frame (e.g. to hash it, then to draw it) costs nothing.
+        bool orderCurrent;
+        std::vector<Entry> entries, scratch;
+        std::vector<unsigned> counts;
+
+        // Never has more than MAX_BUCKETS elements; linear search is fine.
+        std::vector<Key> bucketKeys;
+        std::vector<unsigned> bucketOffsets;
+        std::vector<unsigned char> buckets;
+
+        enum { MAX_BUCKETS = 32, RADIX_BITS = 8, RADIX_SIZE = 1 << RADIX_BITS };
+
+        static Key keyFromZ(ZPos z)
+        {
+            // Map doubles onto unsigned integers with the same ordering.
+            // -0.0 and 0.0 compare equal, so they have to get the same key.
+            if (z == 0)
+                z = 0;
+            Key bits;
+            std::memcpy(&bits, &z, sizeof bits);
+            const Key signBit = Key(1) << 63;
+            return (bits & signBit) ? ~bits : (bits | signBit);
+        }
+
+        bool isSorted() const
+        {
+            for (std::size_t i = 1, n = keys.size(); i < n; ++i)
+                if (keys[i] < keys[i - 1])
+                    return false;
+            return true;
+        }
+
+        // Checks if the last frame's order still results in a stable sort.
+        bool lastOrderStillValid() const
+        {
+            std::size_t n = keys.size();
+            if (lastOrder.size() != n || n == 0)
+                return false;
+
+            for (std::size_t i = 1; i < n; ++i)
+            {
+                Key previous = keys[lastOrder[i - 1]], current = keys[lastOrder[i]];
+                if (current < previous || (current == previous && lastOrder[i] < lastOrder[i - 1]))
+                    return false;
+            }
+            return true;
+        }
+
+        // Sorts by counting into a few buckets if there are only a handful of
+        // different Z values. This is the common case of integer layers.
+        bool sortIntoBuckets()
+        {
+            bucketKeys.clear();
+            std::size_t n = keys.size();
+            Key lastKey = keys[0];
+            bucketKeys.push_back(lastKey);
+            for (std::size_t i = 1; i < n; ++i)
+            {
+                if (keys[i] == lastKey)
+                    continue;
+                lastKey = keys[i];
+                if (std::find(bucketKeys.begin(), bucketKeys.end(), lastKey) != bucketKeys.end())
+                    continue;
+                if (bucketKeys.size() == static_cast<std::size_t>(MAX_BUCKETS))
+                    return false;
+                bucketKeys.push_back(lastKey);
+            }
+            std::sort(bucketKeys.begin(), bucketKeys.end());
+
+            std::size_t numBuckets = bucketKeys.size();
+            bucketOffsets.assign(numBuckets, 0);
+            buckets.resize(n);
+            std::size_t lastBucket = bucketOf(keys[0]);
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                if (keys[i] != bucketKeys[lastBucket])
+                    lastBucket = bucketOf(keys[i]);
+                buckets[i] = lastBucket;
+                ++bucketOffsets[lastBucket];
+            }
+            unsigned sum = 0;
+            for (std::size_t b = 0; b < numBuckets; ++b)
+            {
+                unsigned count = bucketOffsets[b];
+                bucketOffsets[b] = sum;
+                sum += count;
+            }
+
+            order.resize(n);
+            for (std::size_t i = 0; i < n; ++i)
+                order[bucketOffsets[buckets[i]]++] = i;
+            return true;
+        }
+
+        std::size_t bucketOf(Key key) const
+        {
+            return std::lower_bound(bucketKeys.begin(), bucketKeys.end(), key) - bucketKeys.begin();
+        }
+
+        // Stable LSD radix sort over the key bits. Passes in which all keys
+        // share the same digit are skipped.
+        void radixSort()
+        {
+            std::size_t n = keys.size();
+            entries.resize(n);
+            scratch.resize(n);
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                entries[i].key = keys[i];
+                entries[i].index = i;
+            }
+
+            const int PASSES = 64 / RADIX_BITS;
+            counts.assign(PASSES * RADIX_SIZE, 0);
+            for (std::size_t i = 0; i < n; ++i)
+                for (int pass = 0; pass < PASSES; ++pass)
+                    ++counts[pass * RADIX_SIZE + ((keys[i] >> (pass * RADIX_BITS)) & (RADIX_SIZE - 1))];
+
+            Entry* source = &entries[0];
+            Entry* target = &scratch[0];
+            for (int pass = 0; pass < PASSES; ++pass)
+            {
+                unsigned* passCounts = &counts[pass * RADIX_SIZE];
+                int shift = pass * RADIX_BITS;
+
+                if (passCounts[(source[0].key >> shift) & (RADIX_SIZE - 1)] == n)
+                    continue;
+
+                unsigned sum = 0;
+                for (int digit = 0; digit < RADIX_SIZE; ++digit)
+                {
+                    unsigned count = passCounts[digit];
+                    passCounts[digit] = sum;
+                    sum += count;
+                }
+                for (std::size_t i = 0; i < n; ++i)
+                    target[passCounts[(source[i].key >> shift) & (RADIX_SIZE - 1)]++] = source[i];
+                std::swap(source, target);
+            }
+
+            order.resize(n);
+            for (std::size_t i = 0; i < n; ++i)
+                order[i] = source[i].index;
+        }
+
+    public:
+        DrawOpSorter()
+        : orderCurrent(false)
+        {
+        }
+
+        // Must be called once per op, in the order in which the ops were scheduled.
+        void addKey(ZPos z)
+        {
+            keys.push_back(keyFromZ(z));
+            orderCurrent = false;
+        }
+
+        // Adds the keys of another sorter after this one's, as if they had
+        // been added one by one.
+        void append(const DrawOpSorter& other)
+        {
+            keys.insert(keys.end(), other.keys.begin(), other.keys.end());
+            orderCurrent = false;
+        }
+        
+        std::size_t size() const
+        {
+            return keys.size();
+        }
+
+        // Returns the indices of all added keys in stably sorted order.
+        const Order& sort()
+        {
+            if (orderCurrent)
+                return order;
+
+            std::size_t n = keys.size();
+
+            if (isSorted())
+            {
+                order.resize(n);
+                for (std::size_t i = 0; i < n; ++i)
+                    order[i] = i;
+            }
+            else if (lastOrderStillValid())
+                order.swap(lastOrder);
+            else if (!sortIntoBuckets())
+                radixSort();
+
+            lastOrder = order;
+            orderCurrent = true;
+            return order;
+        }
+
+        // Forgets the keys, but remembers the last order for the next frame.
+        void clear()
+        {
+            keys.clear();
+            orderCurrent = false;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,217 @@
+#ifndef GOSUIMPL_GRAPHICS_FRAMEARENA_HPP
+#define GOSUIMPL_GRAPHICS_FRAMEARENA_HPP
+
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+namespace Gosu
+{
+    // Bump allocator for everything that only needs to live until the queue
+    // is cleared. reset() keeps the memory around, so once the arena has seen
+    // the largest frame, no more heap allocations happen.
+    class FrameArena
+    {
+        struct Chunk
+        {
+            char* memory;
+            std::size_t size;
+        };
+        std::vector<Chunk> chunks;
+        std::size_t currentChunk, offset;
+
+        struct Cleanup
+        {
+            void (*destroy)(void*);
+            void* object;
+        };
+        std::vector<Cleanup> cleanups;
+
+        std::size_t bytesUsed;
+        unsigned heapAllocations;
+
+        static const std::size_t MIN_CHUNK_SIZE = 256 * 1024;
+
+        template<typename T>
+        static void destroy(void* object)
+        {
+            static_cast<T*>(object)->~T();
+        }
+
+        void addChunk(std::size_t minSize)
+        {
+            std::size_t size = chunks.empty() ? std::size_t(MIN_CHUNK_SIZE) :
+                chunks.back().size * 2;
+            while (size < minSize)
+                size *= 2;
+            Chunk chunk;
+            chunk.memory = static_cast<char*>(std::malloc(size));
+            if (!chunk.memory)
+                throw std::bad_alloc();
+            chunk.size = size;
+            chunks.push_back(chunk);
+            ++heapAllocations;
+        }
+
+        void releaseChunks()
+        {
+            for (std::size_t i = 0; i < chunks.size(); ++i)
+                std::free(chunks[i].memory);
+            chunks.clear();
+        }
+
+    public:
+        FrameArena()
+        : currentChunk(0), offset(0), bytesUsed(0), heapAllocations(0)
+        {
+        }
+
+        // Arenas can only be copied while they are empty, because the
+        // pointers handed out by the original cannot be transferred.
+        // The copy starts out without any memory.
+        FrameArena(const FrameArena& other)
+        : currentChunk(0), offset(0), bytesUsed(0), heapAllocations(0)
+        {
+            assert (other.bytesUsed == 0);
+        }
+
+        FrameArena& operator=(const FrameArena& other)
+        {
+            assert (bytesUsed == 0 && other.bytesUsed == 0);
+            return *this;
+        }
+
+        ~FrameArena()
+        {
+            reset();
+            releaseChunks();
+        }
+
+        void* allocate(std::size_t size, std::size_t alignment = sizeof(double))
+        {
+            for (;;)
+            {
+                if (currentChunk < chunks.size())
+                {
+                    std::size_t start = (offset + alignment - 1) / alignment * alignment;
+                    if (start + size <= chunks[currentChunk].size)
+                    {
+                        offset = start + size;
+                        bytesUsed += size;
+                        return chunks[currentChunk].memory + start;
+                    }
+                    // Try the next chunk if there is one.
+                    if (currentChunk + 1 < chunks.size())
+                    {
+                        ++currentChunk;
+                        offset = 0;
+                        continue;
+                    }
+                }
+                addChunk(size + alignment);
+                currentChunk = chunks.size() - 1;
+                offset = 0;
+            }
+        }
+
+        // Copies the given object into the arena. Its destructor will be run
+        // when the arena is reset.
+        template<typename T>
+        T* create(const T& prototype)
+        {
+            void* memory = allocate(sizeof(T));
+            T* object = new(memory) T(prototype);
+            Cleanup cleanup = { &destroy<T>, object };
+            cleanups.push_back(cleanup);
+            return object;
+        }
+
+        void reset()
+        {
+            for (std::size_t i = cleanups.size(); i > 0; --i)
+                cleanups[i - 1].destroy(cleanups[i - 1].object);
+            cleanups.clear();
+
+            // If this frame needed more than one chunk, replace them by one
+            // that is large enough for the largest frame so far.
+            if (currentChunk > 0)
+            {
+                std::size_t size = 0;
+                for (std::size_t i = 0; i < chunks.size(); ++i)
+                    size += chunks[i].size;
+                releaseChunks();
+                addChunk(size);
+            }
+
+            currentChunk = 0;
+            offset = 0;
+            bytesUsed = 0;
+            heapAllocations = 0;
+        }
+
+        // Statistics since the last reset.
+        std::size_t used() const { return bytesUsed; }
+        unsigned allocations() const { return heapAllocations; }
+    };
+
+    // A sequence of elements stored in fixed-size blocks inside a FrameArena.
+    // Unlike std::vector, elements never move when the sequence grows.
+    // The arena is passed in explicitly so that copies of an empty sequence
+    // do not refer to the arena of the original.
+    template<typename T>
+    class ArenaSequence
+    {
+        enum { BLOCK_BITS = 10, BLOCK_SIZE = 1 << BLOCK_BITS };
+        std::vector<T*> blocks;
+        std::size_t count;
+
+    public:
+        ArenaSequence()
+        : count(0)
+        {
+        }
+
+        // T must not require a destructor; none will be called.
+        T& push_back(FrameArena& arena, const T& value)
+        {
+            if ((count >> BLOCK_BITS) == blocks.size())
+                blocks.push_back(static_cast<T*>(arena.allocate(sizeof(T) * BLOCK_SIZE)));
+            T* element = new(&blocks[count >> BLOCK_BITS][count & (BLOCK_SIZE - 1)]) T(value);
+            ++count;
+            return *element;
+        }
+
+        T& operator[](std::size_t index)
+        {
+            assert (index < count);
+            return blocks[index >> BLOCK_BITS][index & (BLOCK_SIZE - 1)];
+        }
+
+        const T& operator[](std::size_t index) const
+        {
+            assert (index < count);
+            return blocks[index >> BLOCK_BITS][index & (BLOCK_SIZE - 1)];
+        }
+
+        std::size_t size() const
+        {
+            return count;
+        }
+
+        bool empty() const
+        {
+            return count == 0;
+        }
+
+        // Must be called whenever the arena is reset.
+        void clear()
+        {
+            blocks.clear();
+            count = 0;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef GOSUIMPL_GRAPHICS_FRAMEHASH_HPP
+#define GOSUIMPL_GRAPHICS_FRAMEHASH_HPP
+
+#include <Gosu/TR1.hpp>
+#include "Common.hpp"
+#include <cstring>
+
+// Accumulates a 64 bit hash of everything that goes into a frame, so that
+// identical frames can be recognized. Fast rather than strong: one multiply
+// per word.
+class Gosu::FrameHash
+{
+    std::tr1::uint64_t value;
+
+    static std::tr1::uint64_t multiplier()
+    {
+        // 0x9e3779b97f4a7c15, the golden ratio.
+        return std::tr1::uint64_t(0x9e3779b9) << 32 | 0x7f4a7c15;
+    }
+
+public:
+    FrameHash()
+    : value(0)
+    {
+    }
+
+    void add(std::tr1::uint64_t word)
+    {
+        value = (value << 27 | value >> 37) ^ word;
+        value *= multiplier();
+    }
+
+    void add(double number)
+    {
+        std::tr1::uint64_t bits;
+        std::memcpy(&bits, &number, sizeof bits);
+        add(bits);
+    }
+
+    void add(float number)
+    {
+        std::tr1::uint32_t bits;
+        std::memcpy(&bits, &number, sizeof bits);
+        add(std::tr1::uint64_t(bits));
+    }
+
+    void add(const void* pointer)
+    {
+        add(std::tr1::uint64_t(reinterpret_cast<std::size_t>(pointer)));
+    }
+
+    // Returns a different number on each call, for use in identities of
+    // objects whose address might be reused. Main thread only.
+    static std::tr1::uint64_t uniqueValue()
+    {
+        static std::tr1::uint64_t last = 0;
+        return ++last;
+    }
+
+    // Never 0, so that 0 can mean "no hash".
+    std::tr1::uint64_t result() const
+    {
+        return (value ^ (value >> 31)) | 1;
+    }
+};
+
+#endif
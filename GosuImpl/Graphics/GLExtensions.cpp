@@ -0,0 +1,174 @@
+#include "GLExtensions.hpp"
+#include "../Threading.hpp"
+#include <cstdio>
+#include <cstring>
+
+#ifndef GOSU_IS_IPHONE
+
+#if defined(GOSU_IS_WIN)
+// wglGetProcAddress comes with windows.h.
+#elif defined(GOSU_IS_MAC)
+#include <dlfcn.h>
+#else
+#include <GL/glx.h>
+#endif
+
+namespace Gosu
+{
+    namespace GL
+    {
+        void (GOSU_GLAPI* genBuffers)(GLsizei, GLuint*) = 0;
+        void (GOSU_GLAPI* deleteBuffers)(GLsizei, const GLuint*) = 0;
+        void (GOSU_GLAPI* bindBuffer)(GLenum, GLuint) = 0;
+        void (GOSU_GLAPI* bufferData)(GLenum, SizeIPtr, const GLvoid*, GLenum) = 0;
+        void (GOSU_GLAPI* bufferSubData)(GLenum, IntPtr, SizeIPtr, const GLvoid*) = 0;
+        GLvoid* (GOSU_GLAPI* mapBuffer)(GLenum, GLenum) = 0;
+        GLboolean (GOSU_GLAPI* unmapBuffer)(GLenum) = 0;
+        GLvoid* (GOSU_GLAPI* mapBufferRange)(GLenum, IntPtr, SizeIPtr, GLbitfield) = 0;
+        Sync (GOSU_GLAPI* fenceSync)(GLenum, GLbitfield) = 0;
+        GLenum (GOSU_GLAPI* clientWaitSync)(Sync, GLbitfield, std::tr1::uint64_t) = 0;
+        void (GOSU_GLAPI* deleteSync)(Sync) = 0;
+        void (GOSU_GLAPI* genFramebuffers)(GLsizei, GLuint*) = 0;
+        void (GOSU_GLAPI* deleteFramebuffers)(GLsizei, const GLuint*) = 0;
+        void (GOSU_GLAPI* bindFramebuffer)(GLenum, GLuint) = 0;
+        void (GOSU_GLAPI* framebufferTexture2D)(GLenum, GLenum, GLenum, GLuint, GLint) = 0;
+        GLenum (GOSU_GLAPI* checkFramebufferStatus)(GLenum) = 0;
+        void (GOSU_GLAPI* blendFuncSeparate)(GLenum, GLenum, GLenum, GLenum) = 0;
+        void (GOSU_GLAPI* genQueries)(GLsizei, GLuint*) = 0;
+        void (GOSU_GLAPI* deleteQueries)(GLsizei, const GLuint*) = 0;
+        void (GOSU_GLAPI* beginQuery)(GLenum, GLuint) = 0;
+        void (GOSU_GLAPI* endQuery)(GLenum) = 0;
+        void (GOSU_GLAPI* getQueryObjectiv)(GLuint, GLenum, GLint*) = 0;
+        void (GOSU_GLAPI* getQueryObjectui64v)(GLuint, GLenum, std::tr1::uint64_t*) = 0;
+        void (GOSU_GLAPI* getInternalformativ)(GLenum, GLenum, GLenum, GLsizei, GLint*) = 0;
+    }
+}
+
+namespace
+{
+    Gosu::Mutex loadMutex;
+    bool loaded = false;
+
+    void* procAddress(const char* name)
+    {
+        #if defined(GOSU_IS_WIN)
+        return reinterpret_cast<void*>(wglGetProcAddress(name));
+        #elif defined(GOSU_IS_MAC)
+        return dlsym(RTLD_DEFAULT, name);
+        #else
+        return reinterpret_cast<void*>(glXGetProcAddressARB(
+            reinterpret_cast<const GLubyte*>(name)));
+        #endif
+    }
+
+    // Some drivers return non-null addresses for functions they do not know,
+    // so this is only called after checking the version or extension string.
+    template<typename Function>
+    void load(Function& function, const char* name, const char* suffix = "")
+    {
+        char fullName[64];
+        std::sprintf(fullName, "%s%s", name, suffix);
+        function = reinterpret_cast<Function>(procAddress(fullName));
+    }
+
+    bool hasExtension(const char* name)
+    {
+        const char* extensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+        if (!extensions)
+            return false;
+
+        std::size_t length = std::strlen(name);
+        for (const char* p = std::strstr(extensions, name); p; p = std::strstr(p + 1, name))
+            if ((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == 0))
+                return true;
+        return false;
+    }
+}
+
+void Gosu::loadGLExtensions()
+{
+    Lock lock(loadMutex);
+    if (loaded)
+        return;
+    loaded = true;
+
+    int major = 1, minor = 0;
+    if (const GLubyte* version = glGetString(GL_VERSION))
+        std::sscanf(reinterpret_cast<const char*>(version), "%d.%d", &major, &minor);
+    int version = major * 10 + minor;
+
+    const char* suffix = 0;
+    if (version >= 15)
+        suffix = "";
+    else if (hasExtension("GL_ARB_vertex_buffer_object"))
+        suffix = "ARB";
+    if (suffix)
+    {
+        load(GL::genBuffers, "glGenBuffers", suffix);
+        load(GL::deleteBuffers, "glDeleteBuffers", suffix);
+        load(GL::bindBuffer, "glBindBuffer", suffix);
+        load(GL::bufferData, "glBufferData", suffix);
+        load(GL::bufferSubData, "glBufferSubData", suffix);
+        load(GL::mapBuffer, "glMapBuffer", suffix);
+        load(GL::unmapBuffer, "glUnmapBuffer", suffix);
+    }
+
+    // Both extensions use the core names.
+    if (GL::bindBuffer && (version >= 30 || hasExtension("GL_ARB_map_buffer_range")))
+        load(GL::mapBufferRange, "glMapBufferRange");
+    if (version >= 32 || hasExtension("GL_ARB_sync"))
+    {
+        load(GL::fenceSync, "glFenceSync");
+        load(GL::clientWaitSync, "glClientWaitSync");
+        load(GL::deleteSync, "glDeleteSync");
+    }
+
+    suffix = 0;
+    if (version >= 30 || hasExtension("GL_ARB_framebuffer_object"))
+        suffix = "";
+    else if (hasExtension("GL_EXT_framebuffer_object"))
+        suffix = "EXT";
+    if (suffix)
+    {
+        load(GL::genFramebuffers, "glGenFramebuffers", suffix);
+        load(GL::deleteFramebuffers, "glDeleteFramebuffers", suffix);
+        load(GL::bindFramebuffer, "glBindFramebuffer", suffix);
+        load(GL::framebufferTexture2D, "glFramebufferTexture2D", suffix);
+        load(GL::checkFramebufferStatus, "glCheckFramebufferStatus", suffix);
+    }
+
+    if (version >= 14)
+        load(GL::blendFuncSeparate, "glBlendFuncSeparate");
+    else if (hasExtension("GL_EXT_blend_func_separate"))
+        load(GL::blendFuncSeparate, "glBlendFuncSeparate", "EXT");
+
+    // Timer queries build on the queries of OpenGL 1.5 (or
+    // ARB_occlusion_query); only reading the result has a name of its own.
+    const char* timerSuffix = 0;
+    if (version >= 33 || hasExtension("GL_ARB_timer_query"))
+        timerSuffix = "";
+    else if (hasExtension("GL_EXT_timer_query"))
+        timerSuffix = "EXT";
+    suffix = 0;
+    if (version >= 15)
+        suffix = "";
+    else if (hasExtension("GL_ARB_occlusion_query"))
+        suffix = "ARB";
+    if (timerSuffix && suffix)
+    {
+        load(GL::genQueries, "glGenQueries", suffix);
+        load(GL::deleteQueries, "glDeleteQueries", suffix);
+        load(GL::beginQuery, "glBeginQuery", suffix);
+        load(GL::endQuery, "glEndQuery", suffix);
+        load(GL::getQueryObjectiv, "glGetQueryObjectiv", suffix);
+        load(GL::getQueryObjectui64v, "glGetQueryObjectui64v", timerSuffix);
+        if (!GL::genQueries || !GL::deleteQueries || !GL::beginQuery || !GL::endQuery ||
+            !GL::getQueryObjectiv)
+            GL::getQueryObjectui64v = 0;
+    }
+
+    if (version >= 43 || hasExtension("GL_ARB_internalformat_query2"))
+        load(GL::getInternalformativ, "glGetInternalformativ");
+}
+
+#endif
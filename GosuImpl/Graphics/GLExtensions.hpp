@@ -0,0 +1,145 @@
+#ifndef GOSUIMPL_GRAPHICS_GLEXTENSIONS_HPP
+#define GOSUIMPL_GRAPHICS_GLEXTENSIONS_HPP
+
+#include <Gosu/Platform.hpp>
+#include <Gosu/TR1.hpp>
+#include "Common.hpp"
+#include <cstddef>
+
+#ifndef GOSU_IS_IPHONE
+
+#ifdef GOSU_IS_WIN
+#define GOSU_GLAPI __stdcall
+#else
+#define GOSU_GLAPI
+#endif
+
+// Tokens that older headers (like the gl.h that comes with Windows) lack.
+#ifndef GL_ARRAY_BUFFER
+#define GL_ARRAY_BUFFER 0x8892
+#endif
+#ifndef GL_STREAM_DRAW
+#define GL_STREAM_DRAW 0x88E0
+#endif
+#ifndef GL_STATIC_DRAW
+#define GL_STATIC_DRAW 0x88E4
+#endif
+#ifndef GL_WRITE_ONLY
+#define GL_WRITE_ONLY 0x88B9
+#endif
+#ifndef GL_MAP_WRITE_BIT
+#define GL_MAP_WRITE_BIT 0x0002
+#endif
+#ifndef GL_MAP_INVALIDATE_RANGE_BIT
+#define GL_MAP_INVALIDATE_RANGE_BIT 0x0004
+#endif
+#ifndef GL_MAP_UNSYNCHRONIZED_BIT
+#define GL_MAP_UNSYNCHRONIZED_BIT 0x0020
+#endif
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+#ifndef GL_SYNC_FLUSH_COMMANDS_BIT
+#define GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+#endif
+#ifndef GL_TIMEOUT_EXPIRED
+#define GL_TIMEOUT_EXPIRED 0x911B
+#endif
+#ifndef GL_FRAMEBUFFER
+#define GL_FRAMEBUFFER 0x8D40
+#endif
+#ifndef GL_FRAMEBUFFER_BINDING
+#define GL_FRAMEBUFFER_BINDING 0x8CA6
+#endif
+#ifndef GL_FRAMEBUFFER_COMPLETE
+#define GL_FRAMEBUFFER_COMPLETE 0x8CD5
+#endif
+#ifndef GL_COLOR_ATTACHMENT0
+#define GL_COLOR_ATTACHMENT0 0x8CE0
+#endif
+#ifndef GL_QUERY_RESULT
+#define GL_QUERY_RESULT 0x8866
+#endif
+#ifndef GL_QUERY_RESULT_AVAILABLE
+#define GL_QUERY_RESULT_AVAILABLE 0x8867
+#endif
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED 0x88BF
+#endif
+#ifndef GL_BGRA
+#define GL_BGRA 0x80E1
+#endif
+#ifndef GL_UNSIGNED_INT_8_8_8_8_REV
+#define GL_UNSIGNED_INT_8_8_8_8_REV 0x8367
+#endif
+#ifndef GL_TEXTURE_IMAGE_FORMAT
+#define GL_TEXTURE_IMAGE_FORMAT 0x828F
+#endif
+
+namespace Gosu
+{
+    // OpenGL functions beyond version 1.1, which some platforms only provide
+    // at runtime. They are null until loadGLExtensions() has been called, and
+    // stay null if the driver does not support them.
+    namespace GL
+    {
+        typedef std::ptrdiff_t IntPtr;
+        typedef std::ptrdiff_t SizeIPtr;
+        typedef struct __GLsync* Sync;
+
+        // OpenGL 1.5 or ARB_vertex_buffer_object.
+        extern void (GOSU_GLAPI* genBuffers)(GLsizei n, GLuint* buffers);
+        extern void (GOSU_GLAPI* deleteBuffers)(GLsizei n, const GLuint* buffers);
+        extern void (GOSU_GLAPI* bindBuffer)(GLenum target, GLuint buffer);
+        extern void (GOSU_GLAPI* bufferData)(GLenum target, SizeIPtr size,
+            const GLvoid* data, GLenum usage);
+        extern void (GOSU_GLAPI* bufferSubData)(GLenum target, IntPtr offset,
+            SizeIPtr size, const GLvoid* data);
+        extern GLvoid* (GOSU_GLAPI* mapBuffer)(GLenum target, GLenum access);
+        extern GLboolean (GOSU_GLAPI* unmapBuffer)(GLenum target);
+
+        // OpenGL 3.0 or ARB_map_buffer_range.
+        extern GLvoid* (GOSU_GLAPI* mapBufferRange)(GLenum target, IntPtr offset,
+            SizeIPtr length, GLbitfield access);
+
+        // OpenGL 3.2 or ARB_sync.
+        extern Sync (GOSU_GLAPI* fenceSync)(GLenum condition, GLbitfield flags);
+        extern GLenum (GOSU_GLAPI* clientWaitSync)(Sync sync, GLbitfield flags,
+            std::tr1::uint64_t timeout);
+        extern void (GOSU_GLAPI* deleteSync)(Sync sync);
+
+        // OpenGL 3.0, ARB_framebuffer_object or EXT_framebuffer_object.
+        extern void (GOSU_GLAPI* genFramebuffers)(GLsizei n, GLuint* framebuffers);
+        extern void (GOSU_GLAPI* deleteFramebuffers)(GLsizei n, const GLuint* framebuffers);
+        extern void (GOSU_GLAPI* bindFramebuffer)(GLenum target, GLuint framebuffer);
+        extern void (GOSU_GLAPI* framebufferTexture2D)(GLenum target, GLenum attachment,
+            GLenum textarget, GLuint texture, GLint level);
+        extern GLenum (GOSU_GLAPI* checkFramebufferStatus)(GLenum target);
+
+        // OpenGL 1.4 or EXT_blend_func_separate.
+        extern void (GOSU_GLAPI* blendFuncSeparate)(GLenum srcRGB, GLenum dstRGB,
+            GLenum srcAlpha, GLenum dstAlpha);
+
+        // OpenGL 3.3, ARB_timer_query or EXT_timer_query. GL_TIME_ELAPSED
+        // queries are only supported if getQueryObjectui64v is not null.
+        extern void (GOSU_GLAPI* genQueries)(GLsizei n, GLuint* ids);
+        extern void (GOSU_GLAPI* deleteQueries)(GLsizei n, const GLuint* ids);
+        extern void (GOSU_GLAPI* beginQuery)(GLenum target, GLuint id);
+        extern void (GOSU_GLAPI* endQuery)(GLenum target);
+        extern void (GOSU_GLAPI* getQueryObjectiv)(GLuint id, GLenum pname, GLint* params);
+        extern void (GOSU_GLAPI* getQueryObjectui64v)(GLuint id, GLenum pname,
+            std::tr1::uint64_t* params);
+
+        // OpenGL 4.3 or ARB_internalformat_query2.
+        extern void (GOSU_GLAPI* getInternalformativ)(GLenum target, GLenum internalformat,
+            GLenum pname, GLsizei bufSize, GLint* params);
+    }
+
+    // Looks up the functions in GL using the current context. Only the first
+    // call does anything.
+    void loadGLExtensions();
+}
+
+#endif
+
+#endif
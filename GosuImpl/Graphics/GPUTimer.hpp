@@ -0,0 +1,225 @@
+#ifndef GOSUIMPL_GRAPHICS_GPUTIMER_HPP
+#define GOSUIMPL_GRAPHICS_GPUTIMER_HPP
+
+#include <Gosu/Inspection.hpp>
+#include "Common.hpp"
+#include "GLExtensions.hpp"
+#include <algorithm>
+#include <cassert>
+#include <deque>
+#include <vector>
+
+namespace Gosu
+{
+    #ifdef GOSU_IS_IPHONE
+    // The iPhone has no timer queries.
+    class GPUTimer
+    {
+    public:
+        enum Phase { gpSubmission, gpMacros, gpGLBlocks, gpNone };
+
+        class Section
+        {
+        public:
+            Section(GPUTimer&, Phase) {}
+            explicit Section(Phase) {}
+        };
+
+        bool setEnabled(bool) { return false; }
+        void endFrame(FrameStats&) {}
+    };
+    #else
+
+    // Measures how long the GPU takes for each phase of a frame, using
+    // GL_TIME_ELAPSED queries. Queries cannot be nested, so every switch to
+    // another phase ends the running query and starts a new one. The results
+    // of a frame are only read once the GPU has them all, usually a few frames
+    // later, so that measuring never stalls.
+    //
+    // Belongs to a single GL context and must only be used while it is current.
+    class GPUTimer
+    {
+    public:
+        enum Phase { gpSubmission, gpMacros, gpGLBlocks, gpNone };
+
+    private:
+        GPUTimer(const GPUTimer&);
+        GPUTimer& operator=(const GPUTimer&);
+
+        struct Query
+        {
+            GLuint name;
+            Phase phase;
+        };
+        typedef std::vector<Query> Queries;
+
+        bool enabled;
+        Phase phase;
+        // Queries of the frame in progress, and of frames the GPU may still
+        // be working on, oldest first.
+        Queries current;
+        std::deque<Queries> pending;
+        std::vector<GLuint> spareNames;
+
+        // In milliseconds, of the newest frame whose results are in.
+        double results[gpNone];
+        bool haveResults;
+
+        // Frames whose results still are not in after this many frames are
+        // given up on.
+        static const std::size_t MAX_PENDING_FRAMES = 8;
+
+        // The timer that Sections without an explicit timer use on this thread.
+        static GPUTimer*& threadTimer();
+
+        GLuint takeName()
+        {
+            if (spareNames.empty())
+            {
+                GLuint name;
+                GL::genQueries(1, &name);
+                return name;
+            }
+            GLuint name = spareNames.back();
+            spareNames.pop_back();
+            return name;
+        }
+
+        Phase switchTo(Phase newPhase)
+        {
+            Phase oldPhase = phase;
+            if (!enabled)
+                newPhase = gpNone;
+            if (newPhase == phase)
+                return oldPhase;
+
+            if (phase != gpNone)
+                GL::endQuery(GL_TIME_ELAPSED);
+            phase = newPhase;
+            if (phase != gpNone)
+            {
+                Query query = { takeName(), phase };
+                GL::beginQuery(GL_TIME_ELAPSED, query.name);
+                current.push_back(query);
+            }
+            return oldPhase;
+        }
+
+        // Reads the results of all frames that are done.
+        void collect()
+        {
+            while (!pending.empty())
+            {
+                Queries& frame = pending.front();
+
+                // Queries finish in order, so if the last one of a frame is
+                // available, all of them are.
+                GLint available = 0;
+                GL::getQueryObjectiv(frame.back().name, GL_QUERY_RESULT_AVAILABLE, &available);
+                if (available)
+                {
+                    std::fill(results, results + gpNone, 0.0);
+                    for (std::size_t i = 0; i < frame.size(); ++i)
+                    {
+                        std::tr1::uint64_t elapsed = 0;
+                        GL::getQueryObjectui64v(frame[i].name, GL_QUERY_RESULT, &elapsed);
+                        results[frame[i].phase] += elapsed / 1000000.0;
+                    }
+                    haveResults = true;
+                }
+                else if (pending.size() <= MAX_PENDING_FRAMES)
+                    break;
+
+                for (std::size_t i = 0; i < frame.size(); ++i)
+                    spareNames.push_back(frame[i].name);
+                pending.pop_front();
+            }
+        }
+
+    public:
+        // Attributes the GPU time spent until its destruction to a phase.
+        class Section
+        {
+            GPUTimer* timer;
+            GPUTimer* previousTimer;
+            Phase previousPhase;
+
+        public:
+            // Also makes the timer the one that Sections on this thread use
+            // for the time being.
+            Section(GPUTimer& timer, Phase phase)
+            : timer(&timer), previousTimer(threadTimer())
+            {
+                threadTimer() = &timer;
+                previousPhase = timer.switchTo(phase);
+            }
+
+            // Does nothing unless this thread has a timer.
+            explicit Section(Phase phase)
+            : timer(threadTimer()), previousTimer(timer), previousPhase(gpNone)
+            {
+                if (timer)
+                    previousPhase = timer->switchTo(phase);
+            }
+
+            ~Section()
+            {
+                if (timer)
+                    timer->switchTo(previousPhase);
+                threadTimer() = previousTimer;
+            }
+        };
+
+        GPUTimer()
+        : enabled(false), phase(gpNone), haveResults(false)
+        {
+        }
+
+        ~GPUTimer()
+        {
+            for (std::size_t i = 0; i < pending.size(); ++i)
+                for (std::size_t j = 0; j < pending[i].size(); ++j)
+                    spareNames.push_back(pending[i][j].name);
+            for (std::size_t i = 0; i < current.size(); ++i)
+                spareNames.push_back(current[i].name);
+            if (!spareNames.empty())
+                GL::deleteQueries(spareNames.size(), &spareNames[0]);
+        }
+
+        // Returns false if the driver has no timer queries. Must not be
+        // called in the middle of a Section.
+        bool setEnabled(bool enable)
+        {
+            assert (phase == gpNone);
+            loadGLExtensions();
+            enabled = enable && GL::getQueryObjectui64v;
+            if (!enabled)
+                haveResults = false;
+            return enabled || !enable;
+        }
+
+        // Finishes the frame and puts the newest results that are in into
+        // the stats.
+        void endFrame(FrameStats& stats)
+        {
+            assert (phase == gpNone);
+            if (!current.empty())
+            {
+                pending.push_back(Queries());
+                pending.back().swap(current);
+            }
+            if (!pending.empty())
+                collect();
+
+            if (haveResults)
+            {
+                stats.gpuSubmitTime = results[gpSubmission] + results[gpMacros] + results[gpGLBlocks];
+                stats.gpuMacroTime = results[gpMacros];
+                stats.gpuGLBlockTime = results[gpGLBlocks];
+            }
+        }
+    };
+    #endif
+}
+
+#endif
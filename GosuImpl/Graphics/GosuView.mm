@@ -3,6 +3,7 @@
 #import <UIKit/UIKit.h>
 
 #import <Gosu/Graphics.hpp>
+#import <Gosu/Timing.hpp>
 #import "Common.hpp"
 #import "GosuView.hpp"
 
@@ -13,6 +14,7 @@ namespace Gosu
     namespace FPS
     {
         void registerFrame();
+        void registerSwapWait(double milliseconds);
     }
 }
 
@@ -91,13 +93,18 @@ int Gosu::clipRectBaseFactor()
     glBindFramebufferOES(GL_FRAMEBUFFER_OES, viewFramebuffer);
     glViewport(0, 0, backingWidth, backingHeight);
     
+    bool rendered = true;
     if (windowInstance().graphics().begin()) {
         windowInstance().draw();
-        windowInstance().graphics().end();
+        rendered = windowInstance().graphics().end();
     }
     
-    glBindRenderbufferOES(GL_RENDERBUFFER_OES, viewRenderbuffer);
-    [context presentRenderbuffer:GL_RENDERBUFFER_OES];
+    if (rendered) {
+        std::tr1::uint64_t startTime = Gosu::nanoseconds();
+        glBindRenderbufferOES(GL_RENDERBUFFER_OES, viewRenderbuffer);
+        [context presentRenderbuffer:GL_RENDERBUFFER_OES];
+        Gosu::FPS::registerSwapWait((Gosu::nanoseconds() - startTime) / 1000000.0);
+    }
 }
 
 - (void)layoutSubviews {
@@ -106,6 +113,7 @@ int Gosu::clipRectBaseFactor()
     if ([self respondsToSelector:@selector(contentScaleFactor)])
         self.contentScaleFactor = Gosu::clipRectBaseFactor();
     [self createFramebuffer];
+    windowInstance().graphics().invalidate();
     [self drawView];
 }
 
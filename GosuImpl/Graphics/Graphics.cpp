@@ -4,21 +4,138 @@
 #include "Texture.hpp"
 #include "TexChunk.hpp"
 #include "LargeImageData.hpp"
+#include "GPUTimer.hpp"
 #include "Macro.hpp"
+#include "RenderThread.hpp"
+#include "UploadThread.hpp"
+#include "StreamingBuffer.hpp"
+#include "GLExtensions.hpp"
+#include "../Threading.hpp"
 #include <Gosu/Bitmap.hpp>
 #include <Gosu/Image.hpp>
+#include <Gosu/Inspection.hpp>
 #include <Gosu/Platform.hpp>
-#if 0
-#include <thread>
-#endif
 #include <cmath>
 #include <algorithm>
 #include <limits>
+#include <map>
+#include <set>
+#include <vector>
 
 #ifdef GOSU_IS_IPHONE
 #include "../Orientation.hpp"
 #endif
 
+namespace Gosu
+{
+    namespace FPS
+    {
+        void registerFrameStats(const FrameStats& stats);
+    }
+}
+
+namespace
+{
+    // Set while the calling thread is attached to a recording context.
+    GOSU_THREAD_LOCAL Gosu::DrawOpQueue* threadQueue = 0;
+}
+
+Gosu::DrawOpQueue& Gosu::currentQueue(DrawOpQueueStack& queues)
+{
+    return threadQueue ? *threadQueue : queues.back();
+}
+
+#ifndef GOSU_IS_IPHONE
+namespace
+{
+    // Set while the calling thread performs draw ops.
+    GOSU_THREAD_LOCAL Gosu::GPUTimer* threadGPUTimer = 0;
+}
+
+Gosu::GPUTimer*& Gosu::GPUTimer::threadTimer()
+{
+    return threadGPUTimer;
+}
+#endif
+
+namespace
+{
+    // Set while the calling thread renders into an image: the x, y, width
+    // and height of the image's area in its texture.
+    GOSU_THREAD_LOCAL const GLint* threadTarget = 0;
+    
+    void resetGLState(unsigned physWidth, unsigned physHeight)
+    {
+        glMatrixMode(GL_PROJECTION);
+        glLoadIdentity();
+        #ifdef GOSU_IS_IPHONE
+        glViewport(0, 0, physWidth, physHeight);
+        glOrthof(0, physWidth, physHeight, 0, -1, 1);
+        #else
+        if (threadTarget)
+        {
+            // Textures are stored with their top row first, i.e. at the bottom.
+            glViewport(threadTarget[0], threadTarget[1], threadTarget[2], threadTarget[3]);
+            glOrtho(0, threadTarget[2], 0, threadTarget[3], -1, 1);
+        }
+        else
+        {
+            glViewport(0, 0, physWidth, physHeight);
+            glOrtho(0, physWidth, physHeight, 0, -1, 1);
+        }
+        #endif
+        
+        glMatrixMode(GL_MODELVIEW);
+        glLoadIdentity();
+        glEnable(GL_BLEND);
+    }
+    
+    // Larger textures need fewer binds and split large images into fewer
+    // parts, but each one takes up its full size in video memory right away
+    // (64 MB at 4096x4096).
+    const unsigned PREFERRED_TEXTURE_SIZE = 4096;
+    
+    unsigned maxTextureSize()
+    {
+        GLint size = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &size);
+        return std::max<GLint>(size, Gosu::MAX_TEXTURE_SIZE);
+    }
+    
+    #ifndef GOSU_IS_IPHONE
+    // Everything is blended into an image as premultiplied colors (see
+    // RenderState::applyAlphaMode), so that alpha adds up properly. Images
+    // are drawn with straight colors, though, so this reads the area back,
+    // divides by the alpha and writes the result to the image's texture.
+    void unpremultiplyTarget(const GLint* area, GLuint texName, GLint x, GLint y)
+    {
+        std::vector<unsigned char> pixels(area[2] * area[3] * 4);
+        if (pixels.empty())
+            return;
+        glReadPixels(area[0], area[1], area[2], area[3], GL_RGBA, GL_UNSIGNED_BYTE,
+            &pixels[0]);
+        for (std::size_t i = 0; i < pixels.size(); i += 4)
+        {
+            unsigned alpha = pixels[i + 3];
+            if (alpha == 0 || alpha == 255)
+                continue;
+            for (std::size_t c = i; c < i + 3; ++c)
+                pixels[c] = std::min(255u, (pixels[c] * 255 + alpha / 2) / alpha);
+        }
+        glBindTexture(GL_TEXTURE_2D, texName);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, area[2], area[3],
+            GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+    }
+    #endif
+    
+    void setUpRenderThread(const std::tr1::function<void()>& makeCurrent,
+        unsigned physWidth, unsigned physHeight)
+    {
+        makeCurrent();
+        resetGLState(physWidth, physHeight);
+    }
+}
+
 struct Gosu::Graphics::Impl
 {
     unsigned virtWidth, virtHeight;
@@ -27,11 +144,167 @@ struct Gosu::Graphics::Impl
     DrawOpQueueStack queues;
     typedef std::vector<std::tr1::shared_ptr<Texture> > Textures;
     Textures textures;
+    // Images from renderToImage get textures of their own, so that drawing
+    // other images into them does not read from the texture being rendered.
+    Textures targetTextures;
+    unsigned textureSize;
+    // See setAutoCompaction; and Texture::releases() as of the last check.
+    double autoCompaction;
+    unsigned long lastReleases;
+    
+    // Queues of parallel recording contexts, merged in this order at flush.
+    typedef std::map<unsigned, DrawOpQueueStack::iterator> RecordingContexts;
+    RecordingContexts contexts;
+    DrawOpQueueStack contextQueues;
+    Mutex contextsMutex;
+    // Other threads must not look at the queues, as the main thread changes
+    // them while they draw. Recording contexts start from this copy of the
+    // screen queue's settings instead, which is taken when the frame starts.
+    // Guarded by contextsMutex, like nested.
+    DrawOpQueue contextPrototype;
+    // Set while a macro is recorded or an image rendered.
+    bool nested;
+    
+    void updateContextPrototype()
+    {
+        Lock lock(contextsMutex);
+        contextPrototype.configureLike(queues.front());
+        nested = queues.size() > 1;
+    }
+    
+    void resizeQueues(std::size_t depth)
+    {
+        queues.resize(depth);
+        Lock lock(contextsMutex);
+        nested = depth > 1;
+    }
+    
+    // Of the frame in progress.
+    FrameStats stats;
+    
+    #ifndef GOSU_IS_IPHONE
+    // Used by renderToImage on the main thread's context.
+    GLuint framebuffer;
+    #endif
+    
+    // Vertices of the screen queue are streamed through this, and its GPU
+    // time measured, unless there is a render thread, which has its own.
+    StreamingBuffer vertexBuffer;
+    GPUTimer gpuTimer;
+    bool gpuTiming;
+    
+    // Pipelined rendering: flushed screen queues, and the context queues that
+    // their ops refer to, wait here until the frame is handed over.
+    std::auto_ptr<RenderThread> renderThread;
+    DrawOpQueueStack frameQueues, retainedQueues, spareQueues;
+    Color clearColor;
+    
+    // Skipping identical frames also holds back the frame until end(). It is
+    // only rendered on this thread early if beginGL needs it.
+    bool skipIdenticalFrames, frameStarted, invalidated;
+    std::tr1::uint64_t lastFrameHash;
+    unsigned long skippedFrames;
+    
+    bool defersFrames() const
+    {
+        return renderThread.get() || skipIdenticalFrames;
+    }
+    
+    // Hands queues that are done with back for reuse.
+    void recycleQueues(DrawOpQueueStack& list)
+    {
+        for (DrawOpQueueStack::iterator it = list.begin(); it != list.end(); ++it)
+            it->clearQueue();
+        spareQueues.splice(spareQueues.end(), list);
+    }
+    
+    // Renders the held back queues on this thread, clearing the screen first
+    // unless some of this frame has already been rendered.
+    void performFrameQueues()
+    {
+        if (!frameStarted)
+        {
+            glClearColor(clearColor.red() / 255.f, clearColor.green() / 255.f,
+                clearColor.blue() / 255.f, clearColor.alpha() / 255.f);
+            glClear(GL_COLOR_BUFFER_BIT);
+            frameStarted = true;
+        }
+        for (DrawOpQueueStack::iterator it = frameQueues.begin(); it != frameQueues.end(); ++it)
+            it->performDrawOpsAndCode(vertexBuffer, gpuTimer, stats);
+        recycleQueues(frameQueues);
+        recycleQueues(retainedQueues);
+    }
+    
+    // Returns true if the held back frame is the same as the one before.
+    bool frameIsIdentical()
+    {
+        FrameHash hash;
+        hash.add(std::tr1::uint64_t(clearColor.argb()));
+        bool known = !invalidated && !frameStarted;
+        for (DrawOpQueueStack::iterator it = frameQueues.begin(); known && it != frameQueues.end(); ++it)
+            known = it->hashInto(hash);
+        
+        std::tr1::uint64_t previous = lastFrameHash;
+        lastFrameHash = known ? hash.result() : 0;
+        invalidated = false;
+        return known && lastFrameHash == previous;
+    }
+    
+    // Puts a cleared queue into the given list, reusing one that the render
+    // thread is done with if possible.
+    DrawOpQueueStack::iterator insertSpareQueue(DrawOpQueueStack& list,
+        DrawOpQueueStack::iterator position)
+    {
+        if (renderThread.get())
+            renderThread->recycle(spareQueues);
+        if (spareQueues.empty())
+            return list.insert(position, DrawOpQueue());
+        DrawOpQueueStack::iterator queue = spareQueues.begin();
+        list.splice(position, spareQueues, queue);
+        return queue;
+    }
+    
+    // If set, commitTextures hands uploads to this thread. Textures and
+    // their allocators are still only touched on the main thread.
+    std::tr1::shared_ptr<UploadThread> uploadThread;
+    bool uploadThreadFailed;
+    
+    // Uploads everything that is staged or in flight, so that the textures
+    // can be drawn or read on this thread's context.
+    void finishTextures()
+    {
+        for (Textures::const_iterator i = textures.begin(); i != textures.end(); ++i)
+            (*i)->commit();
+    }
+    
+    // Allocates a transparent area for renderToImage, on the first target
+    // texture that it fits on. There are usually only a few. The area is
+    // uploaded right away so that nothing overwrites it after rendering.
+    std::auto_ptr<TexChunk> allocTarget(Graphics& graphics, unsigned width, unsigned height)
+    {
+        Bitmap transparent(width, height);
+        std::auto_ptr<TexChunk> chunk;
+        for (std::size_t i = 0; i < targetTextures.size(); ++i)
+        {
+            chunk = targetTextures[i]->tryAlloc(graphics, queues, targetTextures[i],
+                transparent, 0, 0, width, height, bfSmooth, 1);
+            if (chunk.get())
+            {
+                targetTextures[i]->commit();
+                return chunk;
+            }
+        }
+        
+        std::tr1::shared_ptr<Texture> texture(new Texture(textureSize));
+        targetTextures.push_back(texture);
+        chunk = texture->tryAlloc(graphics, queues, texture,
+            transparent, 0, 0, width, height, bfSmooth, 1);
+        if (!chunk.get())
+            throw std::logic_error("Internal texture block allocation error");
+        texture->commit();
+        return chunk;
+    }
     
-#if 0
-    std::mutex texMutex;
-#endif
-
 #ifdef GOSU_IS_IPHONE
     Transform transformForOrientation(Orientation orientation)
     {
@@ -58,6 +331,11 @@ struct Gosu::Graphics::Impl
 #endif
 };
 
+Gosu::DrawOpQueue& Gosu::currentQueue(Graphics& graphics)
+{
+    return currentQueue(graphics.pimpl->queues);
+}
+
 Gosu::Graphics::Graphics(unsigned physWidth, unsigned physHeight, bool fullscreen)
 : pimpl(new Impl)
 {
@@ -69,29 +347,39 @@ Gosu::Graphics::Graphics(unsigned physWidth, unsigned physHeight, bool fullscree
     std::swap(pimpl->virtWidth, pimpl->virtHeight);
     #endif
     pimpl->fullscreen = fullscreen;
+    pimpl->stats = FrameStats();
+    pimpl->gpuTiming = false;
+    pimpl->autoCompaction = 0;
+    pimpl->lastReleases = Texture::releases();
+    pimpl->skipIdenticalFrames = false;
+    pimpl->frameStarted = false;
+    pimpl->invalidated = false;
+    pimpl->lastFrameHash = 0;
+    pimpl->skippedFrames = 0;
+    pimpl->uploadThreadFailed = false;
     
     // Should be merged into RenderState altogether.
-    
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glViewport(0, 0, physWidth, physHeight);
-    #ifdef GOSU_IS_IPHONE
-    glOrthof(0, physWidth, physHeight, 0, -1, 1);
-    #else
-    glOrtho(0, physWidth, physHeight, 0, -1, 1);
+    resetGLState(physWidth, physHeight);
+    pimpl->textureSize = std::min(maxTextureSize(), PREFERRED_TEXTURE_SIZE);
+    #ifndef GOSU_IS_IPHONE
+    loadGLExtensions();
+    pimpl->framebuffer = 0;
     #endif
     
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-    
-    glEnable(GL_BLEND);
-    
     // Create default draw-op queue.
     pimpl->queues.resize(1);
+    pimpl->queues.front().enableCulling(physWidth, physHeight);
+    pimpl->updateContextPrototype();
 }
 
 Gosu::Graphics::~Graphics()
 {
+    stopRenderThread();
+    stopUploadThread();
+    #ifndef GOSU_IS_IPHONE
+    if (pimpl->framebuffer != 0)
+        GL::deleteFramebuffers(1, &pimpl->framebuffer);
+    #endif
 }
 
 unsigned Gosu::Graphics::width() const
@@ -127,13 +415,39 @@ bool Gosu::Graphics::begin(Gosu::Color clearWithColor)
 {
     // If recording is in process, cancel it.
     assert (pimpl->queues.size() == 1);
-    pimpl->queues.resize(1);
+    pimpl->resizeQueues(1);
     // Clear leftover transforms, clip rects etc.
     pimpl->queues.front().reset();
+    for (Impl::RecordingContexts::iterator it = pimpl->contexts.begin();
+        it != pimpl->contexts.end(); ++it)
+        it->second->clearQueue();
+    pimpl->stats = FrameStats();
+    
+    if (pimpl->autoCompaction > 0 && pimpl->lastReleases != Texture::releases())
+    {
+        pimpl->lastReleases = Texture::releases();
+        for (Impl::Textures::const_iterator i = pimpl->textures.begin();
+            i != pimpl->textures.end(); ++i)
+            if ((*i)->occupancy() < pimpl->autoCompaction)
+            {
+                compactTextures(pimpl->autoCompaction);
+                break;
+            }
+    }
     
     #ifdef GOSU_IS_IPHONE
     pimpl->updateBaseTransform();
     #endif
+    pimpl->updateContextPrototype();
+    
+    // The screen is cleared right before drawing the held back frame.
+    if (pimpl->defersFrames())
+    {
+        pimpl->clearColor = clearWithColor;
+        pimpl->frameStarted = false;
+        return true;
+    }
+    
     glClearColor(clearWithColor.red() / 255.f, clearWithColor.green() / 255.f,
         clearWithColor.blue() / 255.f, clearWithColor.alpha() / 255.f);
     glClear(GL_COLOR_BUFFER_BIT);
@@ -141,24 +455,316 @@ bool Gosu::Graphics::begin(Gosu::Color clearWithColor)
     return true;
 }
 
-void Gosu::Graphics::end()
+bool Gosu::Graphics::end()
 {
     // If recording is in process, cancel it.
     assert (pimpl->queues.size() == 1);
-    pimpl->queues.resize(1);
+    pimpl->resizeQueues(1);
     
     flush();
     
+    if (pimpl->skipIdenticalFrames && pimpl->frameIsIdentical())
+    {
+        pimpl->recycleQueues(pimpl->frameQueues);
+        pimpl->recycleQueues(pimpl->retainedQueues);
+        ++pimpl->skippedFrames;
+        pimpl->stats.skipped = true;
+        pimpl->gpuTimer.endFrame(pimpl->stats);
+        FPS::registerFrameStats(pimpl->stats);
+        return false;
+    }
+    
+    if (pimpl->renderThread.get())
+    {
+        // Textures are created on this thread's context. Make sure that they
+        // are complete before the render thread's context uses them.
+        glFinish();
+        // Only renderToImage uses this thread's timer now, and the render
+        // thread reports the frame's GPU time.
+        FrameStats ignored;
+        pimpl->gpuTimer.endFrame(ignored);
+        pimpl->renderThread->submit(pimpl->frameQueues, pimpl->retainedQueues,
+            pimpl->clearColor, pimpl->stats);
+        FPS::registerFrameStats(pimpl->stats);
+        return true;
+    }
+    
+    if (pimpl->skipIdenticalFrames)
+        pimpl->performFrameQueues();
+    pimpl->vertexBuffer.endFrame();
+    pimpl->gpuTimer.endFrame(pimpl->stats);
     glFlush();
+    FPS::registerFrameStats(pimpl->stats);
+    return true;
 }
 
 void Gosu::Graphics::flush()
 {
     if (pimpl->queues.size() != 1)
         throw std::logic_error("Flushing to screen is not allowed while creating a macro");
+    if (threadQueue)
+        throw std::logic_error("Flushing to screen is not allowed from a recording context");
+    
+    pimpl->finishTextures();
+    
+    DrawOpQueue& queue = pimpl->queues.front();
+    for (Impl::RecordingContexts::iterator it = pimpl->contexts.begin();
+        it != pimpl->contexts.end(); ++it)
+    {
+        queue.mergeFrom(*it->second);
+        pimpl->stats.arenaBytes += it->second->arenaBytes();
+        pimpl->stats.arenaAllocations += it->second->arenaAllocations();
+    }
+    pimpl->stats.drawOps += queue.drawOps();
+    pimpl->stats.culledDrawOps += queue.culledOps();
+    pimpl->stats.arenaBytes += queue.arenaBytes();
+    pimpl->stats.arenaAllocations += queue.arenaAllocations();
+    
+    if (pimpl->defersFrames())
+    {
+        // Keep the queues around until end() hands them to the render thread
+        // or performs them, and continue drawing into fresh ones.
+        pimpl->insertSpareQueue(pimpl->queues, pimpl->queues.begin())->continueFrom(queue);
+        pimpl->frameQueues.splice(pimpl->frameQueues.end(), pimpl->queues,
+            ++pimpl->queues.begin());
+        
+        for (Impl::RecordingContexts::iterator it = pimpl->contexts.begin();
+            it != pimpl->contexts.end(); ++it)
+        {
+            if (it->second->empty())
+                continue;
+            DrawOpQueueStack::iterator used = it->second;
+            it->second = pimpl->insertSpareQueue(pimpl->contextQueues, used);
+            pimpl->retainedQueues.splice(pimpl->retainedQueues.end(), pimpl->contextQueues, used);
+        }
+        return;
+    }
+    
+    queue.performDrawOpsAndCode(pimpl->vertexBuffer, pimpl->gpuTimer, pimpl->stats);
+    queue.clearQueue();
+    for (Impl::RecordingContexts::iterator it = pimpl->contexts.begin();
+        it != pimpl->contexts.end(); ++it)
+        it->second->clearQueue();
+}
+
+void Gosu::Graphics::commitTextures()
+{
+    for (Impl::Textures::const_iterator i = pimpl->textures.begin();
+        i != pimpl->textures.end(); ++i)
+        (*i)->commit(pimpl->uploadThread);
+}
+
+void Gosu::Graphics::startUploadThread(const std::tr1::function<void()>& makeCurrent,
+    const std::tr1::function<void()>& release)
+{
+    if (pimpl->uploadThread)
+        throw std::logic_error("The upload thread is already running");
+    
+    try
+    {
+        pimpl->uploadThread.reset(new UploadThread(makeCurrent, release));
+    }
+    catch (...)
+    {
+        pimpl->uploadThreadFailed = true;
+        throw;
+    }
+}
+
+void Gosu::Graphics::stopUploadThread()
+{
+    // Afterwards, nothing refers to the thread anymore, and resetting the
+    // pointer ends it.
+    for (Impl::Textures::const_iterator i = pimpl->textures.begin();
+        i != pimpl->textures.end(); ++i)
+        (*i)->finishUploads();
+    pimpl->uploadThread.reset();
+}
+
+bool Gosu::Graphics::hasUploadThread() const
+{
+    return pimpl->uploadThread.get() != 0;
+}
+
+bool Gosu::Graphics::uploadThreadFailed() const
+{
+    return pimpl->uploadThreadFailed;
+}
+
+void Gosu::Graphics::startRenderThread(const std::tr1::function<void()>& makeCurrent,
+    const std::tr1::function<void()>& present, const std::tr1::function<void()>& release)
+{
+    if (pimpl->renderThread.get())
+        throw std::logic_error("The render thread is already running");
+    
+    pimpl->renderThread.reset(new RenderThread(
+        std::tr1::bind(setUpRenderThread, makeCurrent, pimpl->physWidth, pimpl->physHeight),
+        present, release));
+    pimpl->renderThread->setGPUTiming(pimpl->gpuTiming);
+}
+
+void Gosu::Graphics::stopRenderThread()
+{
+    // Waits for the last frame.
+    pimpl->renderThread.reset();
+    pimpl->frameQueues.clear();
+    pimpl->retainedQueues.clear();
+    pimpl->spareQueues.clear();
+}
+
+void Gosu::Graphics::setSkipIdenticalFrames(bool enabled)
+{
+    if (pimpl->queues.size() > 1 || !pimpl->queues.front().empty() || !pimpl->frameQueues.empty())
+        throw std::logic_error("Skipping identical frames can only be changed between frames");
     
-    pimpl->queues.front().performDrawOpsAndCode();
-    pimpl->queues.front().clearQueue();
+    pimpl->skipIdenticalFrames = enabled;
+    pimpl->lastFrameHash = 0;
+}
+
+unsigned long Gosu::Graphics::skippedFrames() const
+{
+    return pimpl->skippedFrames;
+}
+
+void Gosu::Graphics::invalidate()
+{
+    pimpl->invalidated = true;
+}
+
+bool Gosu::Graphics::setGPUTiming(bool enabled)
+{
+    if (pimpl->queues.size() > 1 || !pimpl->queues.front().empty() || !pimpl->frameQueues.empty())
+        throw std::logic_error("GPU timing can only be changed between frames");
+    
+    bool supported = pimpl->gpuTimer.setEnabled(enabled);
+    pimpl->gpuTiming = enabled && supported;
+    if (pimpl->renderThread.get())
+        pimpl->renderThread->setGPUTiming(pimpl->gpuTiming);
+    return supported;
+}
+
+unsigned Gosu::Graphics::textureSize() const
+{
+    return pimpl->textureSize;
+}
+
+void Gosu::Graphics::setTextureSize(unsigned size)
+{
+    if (size < MAX_TEXTURE_SIZE || (size & (size - 1)) != 0 || size > maxTextureSize())
+        throw std::invalid_argument("Unsupported texture size");
+    pimpl->textureSize = size;
+}
+
+unsigned Gosu::Graphics::compactTextures(double maxOccupancy)
+{
+    if (pimpl->queues.size() > 1 || !pimpl->queues.front().empty() || !pimpl->frameQueues.empty())
+        throw std::logic_error("Textures can only be compacted between frames");
+    
+    #ifdef GOSU_IS_IPHONE
+    return 0;
+    #else
+    if (!GL::bindFramebuffer)
+        return 0;
+    TraceZone zone("Graphics::compactTextures");
+    
+    // The frame in flight refers to its textures; wait for it so that only
+    // chunks and macros do.
+    if (pimpl->renderThread.get())
+    {
+        pimpl->renderThread->finish();
+        pimpl->renderThread->recycle(pimpl->spareQueues);
+    }
+    
+    GLint previousFramebuffer;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    if (pimpl->framebuffer == 0)
+        GL::genFramebuffers(1, &pimpl->framebuffer);
+    GL::bindFramebuffer(GL_FRAMEBUFFER, pimpl->framebuffer);
+    
+    Impl::Textures& textures = pimpl->textures;
+    std::set<Texture*> tried;
+    unsigned released = 0;
+    for (;;)
+    {
+        // Empty the least occupied texture that nothing but its own chunks
+        // refers to...
+        Impl::Textures::iterator source = textures.end();
+        for (Impl::Textures::iterator i = textures.begin(); i != textures.end(); ++i)
+            if ((*i)->occupancy() < maxOccupancy && !tried.count(i->get()) &&
+                i->use_count() == long(1 + (*i)->chunkCount()) &&
+                (source == textures.end() || (*i)->occupancy() < (*source)->occupancy()))
+                source = i;
+        if (source == textures.end())
+            break;
+        tried.insert(source->get());
+        
+        // ...into the fullest others first.
+        std::vector<std::pair<double, std::size_t> > targets;
+        for (std::size_t i = 0; i < textures.size(); ++i)
+            if (textures[i] != *source)
+                targets.push_back(std::make_pair(-textures[i]->occupancy(), i));
+        std::sort(targets.begin(), targets.end());
+        
+        bool empty = (*source)->chunkCount() == 0;
+        for (std::size_t i = 0; i < targets.size() && !empty; ++i)
+            empty = (*source)->moveChunksTo(textures[targets[i].second]);
+        if (empty)
+        {
+            textures.erase(source);
+            ++released;
+        }
+    }
+    
+    // Rendered images stay where they are, but their textures can go
+    // once they are all gone.
+    for (Impl::Textures::iterator i = pimpl->targetTextures.begin();
+        i != pimpl->targetTextures.end(); )
+        if (i->use_count() == 1)
+        {
+            i = pimpl->targetTextures.erase(i);
+            ++released;
+        }
+        else
+            ++i;
+    
+    GL::bindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    pimpl->lastReleases = Texture::releases();
+    return released;
+    #endif
+}
+
+void Gosu::Graphics::setAutoCompaction(double maxOccupancy)
+{
+    pimpl->autoCompaction = maxOccupancy;
+}
+
+void Gosu::Graphics::attachRecordingContext(unsigned context)
+{
+    if (threadQueue)
+        throw std::logic_error("This thread is already attached to a recording context");
+    Lock lock(pimpl->contextsMutex);
+    if (pimpl->nested)
+        throw std::logic_error("Recording contexts are not allowed while creating a macro");
+    
+    Impl::RecordingContexts::iterator it = pimpl->contexts.find(context);
+    if (it == pimpl->contexts.end())
+    {
+        pimpl->contextQueues.push_back(DrawOpQueue());
+        it = pimpl->contexts.insert(std::make_pair(context, --pimpl->contextQueues.end())).first;
+    }
+    DrawOpQueue& queue = *it->second;
+    // Start from the screen's state when first used in this frame.
+    if (queue.empty())
+    {
+        queue.reset();
+        queue.configureLike(pimpl->contextPrototype);
+    }
+    threadQueue = &queue;
+}
+
+void Gosu::Graphics::detachRecordingContext()
+{
+    threadQueue = 0;
 }
 
 void Gosu::Graphics::beginGL()
@@ -169,7 +775,13 @@ void Gosu::Graphics::beginGL()
 #ifdef GOSU_IS_IPHONE
     throw std::logic_error("Custom OpenGL is unsupported on the iPhone");
 #else
+    if (pimpl->renderThread.get())
+        throw std::logic_error("Immediate OpenGL is not possible while a render thread is running; use scheduleGL");
+    
     flush();
+    // This frame cannot be skipped anymore.
+    if (pimpl->skipIdenticalFrames)
+        pimpl->performFrameQueues();
     glPushAttrib(GL_ALL_ATTRIB_BITS);
     glDisable(GL_BLEND);
     while (glGetError() != GL_NO_ERROR);
@@ -184,73 +796,44 @@ void Gosu::Graphics::endGL()
     glPopAttrib();
 
     // Restore matrices.
-    
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glViewport(0, 0, pimpl->physWidth, pimpl->physHeight);
-    glOrtho(0, pimpl->physWidth, pimpl->physHeight, 0, -1, 1);
-
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-    glEnable(GL_BLEND);
+    resetGLState(pimpl->physWidth, pimpl->physHeight);
 #endif
 }
 
 #ifdef GOSU_IS_IPHONE
-void Gosu::Graphics::scheduleGL(const std::tr1::function<void()>& functor, Gosu::ZPos z)
+void Gosu::Graphics::scheduleGL(const std::tr1::function<void()>& functor, Gosu::ZPos z,
+    std::tr1::uint64_t identity)
 {
     throw std::logic_error("Custom OpenGL is unsupported on the iPhone");
 }
 #else
-namespace Gosu
+void Gosu::Graphics::scheduleGL(const std::tr1::function<void()>& functor, Gosu::ZPos z,
+    std::tr1::uint64_t identity)
 {
-    struct RunGLFunctor
-    {
-        Graphics& graphics;
-        std::tr1::function<void()> functor;
-        
-        RunGLFunctor(Graphics& graphics, const std::tr1::function<void()>& functor)
-        : graphics(graphics), functor(functor)
-        {
-        }
-        
-        void operator()() const
-        {
-            // Inlined beginGL() to avoid flushing.
-            glPushAttrib(GL_ALL_ATTRIB_BITS);
-            glDisable(GL_BLEND);
-            while (glGetError() != GL_NO_ERROR);
-            
-            functor();
-            
-            // Does not have to be inlined.
-            graphics.endGL();            
-        }
-    };
-}
-
-void Gosu::Graphics::scheduleGL(const std::tr1::function<void()>& functor, Gosu::ZPos z)
-{
-    pimpl->queues.back().scheduleGL(RunGLFunctor(*this, functor), z);
+    Gosu::scheduleGL(*this, functor, z, identity);
 }
 #endif
 
 void Gosu::Graphics::beginClipping(double x, double y, double width, double height)
 {
-    if (pimpl->queues.size() > 1)
-        throw std::logic_error("Clipping is not allowed while creating a macro yet");
+    // Recording contexts have clipping stacks of their own.
+    if (!threadQueue && pimpl->queues.size() > 1)
+        throw std::logic_error("Clipping is not allowed while creating a macro or rendering to an image yet");
     
-    pimpl->queues.back().beginClipping(x, y, width, height, pimpl->physHeight);
+    currentQueue(pimpl->queues).beginClipping(x, y, width, height, pimpl->physHeight);
 }
 
 void Gosu::Graphics::endClipping()
 {
-    pimpl->queues.back().endClipping();
+    currentQueue(pimpl->queues).endClipping();
 }
 
 void Gosu::Graphics::beginRecording()
 {
-    pimpl->queues.resize(pimpl->queues.size() + 1);
+    if (threadQueue)
+        throw std::logic_error("Macros cannot be recorded from a recording context");
+    
+    pimpl->resizeQueues(pimpl->queues.size() + 1);
 }
 
 std::auto_ptr<Gosu::ImageData> Gosu::Graphics::endRecording(int width, int height)
@@ -259,30 +842,133 @@ std::auto_ptr<Gosu::ImageData> Gosu::Graphics::endRecording(int width, int heigh
         throw std::logic_error("No macro recording in progress that can be captured");
     
     std::auto_ptr<ImageData> result(new Macro(*this, pimpl->queues.back(), width, height));
-    pimpl->queues.pop_back();
+    pimpl->resizeQueues(pimpl->queues.size() - 1);
     return result;
 }
 
+std::auto_ptr<Gosu::ImageData> Gosu::Graphics::renderToImage(unsigned width, unsigned height,
+    const std::tr1::function<void()>& functor)
+{
+#ifdef GOSU_IS_IPHONE
+    throw std::logic_error("Rendering to images is unsupported on the iPhone");
+#else
+    if (threadQueue)
+        throw std::logic_error("Images cannot be rendered from a recording context");
+    if (!GL::bindFramebuffer)
+        throw std::runtime_error("Rendering to images requires framebuffer objects");
+    if (!GL::blendFuncSeparate)
+        throw std::runtime_error("Rendering to images requires glBlendFuncSeparate");
+    if (width + 2 > pimpl->textureSize || height + 2 > pimpl->textureSize)
+        throw std::invalid_argument("Images that are rendered to must fit on a single texture");
+    
+    // A transparent area on a texture, just like any other image.
+    std::auto_ptr<TexChunk> chunk = pimpl->allocTarget(*this, width, height);
+    
+    // Record into a queue of its own, as for macros.
+    std::size_t depth = pimpl->queues.size();
+    pimpl->resizeQueues(depth + 1);
+    pimpl->queues.back().enableCulling(width, height);
+    try
+    {
+        functor();
+    }
+    catch (...)
+    {
+        pimpl->resizeQueues(depth);
+        throw;
+    }
+    if (pimpl->queues.size() != depth + 1)
+    {
+        pimpl->resizeQueues(depth);
+        throw std::logic_error("Macros must be finished before the image is rendered");
+    }
+    pimpl->finishTextures();
+    
+    // Sampling from the texture that is rendered into gives undefined
+    // results, so if the functor drew from it (e.g. an image rendered
+    // earlier), render into a temporary texture instead.
+    GLuint staging = 0;
+    if (pimpl->queues.back().mayRead(chunk->texName()))
+    {
+        std::vector<unsigned char> transparent(width * height * 4);
+        glGenTextures(1, &staging);
+        glBindTexture(GL_TEXTURE_2D, staging);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+            GL_RGBA, GL_UNSIGNED_BYTE, &transparent[0]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    
+    GLint previousFramebuffer;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    if (pimpl->framebuffer == 0)
+        GL::genFramebuffers(1, &pimpl->framebuffer);
+    GL::bindFramebuffer(GL_FRAMEBUFFER, pimpl->framebuffer);
+    GL::framebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+        staging ? staging : chunk->texName(), 0);
+    bool complete = GL::checkFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    
+    if (complete)
+    {
+        GLint target[4] = { staging ? 0 : chunk->left(), staging ? 0 : chunk->top(),
+            static_cast<GLint>(width), static_cast<GLint>(height) };
+        threadTarget = target;
+        resetGLState(pimpl->physWidth, pimpl->physHeight);
+        try
+        {
+            pimpl->queues.back().performDrawOpsAndCode(pimpl->vertexBuffer, pimpl->gpuTimer,
+                pimpl->stats);
+        }
+        catch (...)
+        {
+            threadTarget = 0;
+            GL::bindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+            if (staging)
+                glDeleteTextures(1, &staging);
+            resetGLState(pimpl->physWidth, pimpl->physHeight);
+            pimpl->resizeQueues(depth);
+            throw;
+        }
+        threadTarget = 0;
+        // Reads the pixels back, which waits for the GPU.
+        unpremultiplyTarget(target, chunk->texName(), chunk->left(), chunk->top());
+    }
+    
+    GL::bindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    if (staging)
+        glDeleteTextures(1, &staging);
+    resetGLState(pimpl->physWidth, pimpl->physHeight);
+    pimpl->resizeQueues(depth);
+    
+    if (!complete)
+        throw std::runtime_error("Could not render to image");
+    return std::auto_ptr<ImageData>(chunk);
+#endif
+}
+
 void Gosu::Graphics::pushTransform(const Gosu::Transform& transform)
 {
-    pimpl->queues.back().pushTransform(transform);
+    currentQueue(pimpl->queues).pushTransform(transform);
 }
 
 void Gosu::Graphics::popTransform()
 {
-    pimpl->queues.back().popTransform();
+    currentQueue(pimpl->queues).popTransform();
+}
+
+void Gosu::Graphics::setPreTransformVertices(bool enabled)
+{
+    pimpl->queues.front().setPreTransform(enabled);
 }
 
 void Gosu::Graphics::drawLine(double x1, double y1, Color c1,
     double x2, double y2, Color c2, ZPos z, AlphaMode mode)
 {
     DrawOp op;
-    op.renderState.mode = mode;
     op.verticesOrBlockIndex = 2;
     op.vertices[0] = DrawOp::Vertex(x1, y1, c1);
     op.vertices[1] = DrawOp::Vertex(x2, y2, c2);
-    op.z = z;
-    pimpl->queues.back().scheduleDrawOp(op);
+    currentQueue(pimpl->queues).scheduleDrawOp(op, z, std::tr1::shared_ptr<Texture>(), mode);
 }
 
 void Gosu::Graphics::drawTriangle(double x1, double y1, Color c1,
@@ -290,7 +976,6 @@ void Gosu::Graphics::drawTriangle(double x1, double y1, Color c1,
     ZPos z, AlphaMode mode)
 {
     DrawOp op;
-    op.renderState.mode = mode;
     op.verticesOrBlockIndex = 3;
     op.vertices[0] = DrawOp::Vertex(x1, y1, c1);
     op.vertices[1] = DrawOp::Vertex(x2, y2, c2);
@@ -299,8 +984,7 @@ void Gosu::Graphics::drawTriangle(double x1, double y1, Color c1,
     op.verticesOrBlockIndex = 4;
     op.vertices[3] = op.vertices[2];
 #endif
-    op.z = z;
-    pimpl->queues.back().scheduleDrawOp(op);
+    currentQueue(pimpl->queues).scheduleDrawOp(op, z, std::tr1::shared_ptr<Texture>(), mode);
 }
 
 void Gosu::Graphics::drawQuad(double x1, double y1, Color c1,
@@ -310,7 +994,6 @@ void Gosu::Graphics::drawQuad(double x1, double y1, Color c1,
     reorderCoordinatesIfNecessary(x1, y1, x2, y2, x3, y3, c3, x4, y4, c4);
 
     DrawOp op;
-    op.renderState.mode = mode;
     op.verticesOrBlockIndex = 4;
     op.vertices[0] = DrawOp::Vertex(x1, y1, c1);
     op.vertices[1] = DrawOp::Vertex(x2, y2, c2);
@@ -322,15 +1005,14 @@ void Gosu::Graphics::drawQuad(double x1, double y1, Color c1,
     op.vertices[3] = DrawOp::Vertex(x3, y3, c3);
     op.vertices[2] = DrawOp::Vertex(x4, y4, c4);
 #endif
-    op.z = z;
-    pimpl->queues.back().scheduleDrawOp(op);
+    currentQueue(pimpl->queues).scheduleDrawOp(op, z, std::tr1::shared_ptr<Texture>(), mode);
 }
 
 std::auto_ptr<Gosu::ImageData> Gosu::Graphics::createImage(
     const Bitmap& src, unsigned srcX, unsigned srcY,
     unsigned srcWidth, unsigned srcHeight, unsigned borderFlags)
 {
-    static const unsigned maxSize = MAX_TEXTURE_SIZE;
+    const unsigned maxSize = pimpl->textureSize;
 
     // Special case: If the texture is supposed to have hard borders,
     // is quadratic, has a size that is at least 64 pixels but less than 256
@@ -343,23 +1025,12 @@ std::auto_ptr<Gosu::ImageData> Gosu::Graphics::createImage(
         std::tr1::shared_ptr<Texture> texture(new Texture(srcWidth));
         std::auto_ptr<ImageData> data;
         
-        // Use the source bitmap directly if the source area completely covers
-        // it.
-        if (srcX == 0 && srcWidth == src.width() &&
-            srcY == 0 && srcHeight == src.height())
-        {
-            data = texture->tryAlloc(*this, pimpl->queues, texture, src, 0);
-        }
-        else
-        {
-            Bitmap trimmedSrc;
-            trimmedSrc.resize(srcWidth, srcHeight);
-            trimmedSrc.insert(src, 0, 0, srcX, srcY, srcWidth, srcHeight);
-            data = texture->tryAlloc(*this, pimpl->queues, texture, trimmedSrc, 0);
-        }
-        
+        data = texture->tryAlloc(*this, pimpl->queues, texture,
+            src, srcX, srcY, srcWidth, srcHeight, borderFlags, 0);
         if (!data.get())
             throw std::logic_error("Internal texture block allocation error");
+        // Nothing else will ever be staged on this texture.
+        texture->commit();
         return data;
     }
     
@@ -373,22 +1044,30 @@ std::auto_ptr<Gosu::ImageData> Gosu::Graphics::createImage(
         return lidi;
     }
     
-    Bitmap bmp;
-    applyBorderFlags(bmp, src, srcX, srcY, srcWidth, srcHeight, borderFlags);
+    // The border is added when the bitmap is staged on the texture.
+    unsigned paddedWidth = srcWidth + 2, paddedHeight = srcHeight + 2;
 
-#if 0
-    std::mutex::scoped_lock lock(pimpl->texMutex);
-#endif
-    
-    // Try to put the bitmap into one of the already allocated textures.
-    for (Impl::Textures::iterator i = pimpl->textures.begin(); i != pimpl->textures.end(); ++i)
+    // Try to put the bitmap into one of the already allocated textures,
+    // fullest first so that the others keep more room for large images.
+    // Most full textures are ruled out without searching them.
+    Impl::Textures& textures = pimpl->textures;
+    std::vector<bool> rejected(textures.size());
+    for (;;)
     {
-        std::tr1::shared_ptr<Texture> texture(*i);
+        std::size_t best = textures.size();
+        for (std::size_t i = 0; i < textures.size(); ++i)
+            if (!rejected[i] && textures[i]->mayFit(paddedWidth, paddedHeight) &&
+                (best == textures.size() || textures[i]->freeArea() < textures[best]->freeArea()))
+                best = i;
+        if (best == textures.size())
+            break;
         
         std::auto_ptr<ImageData> data;
-        data = texture->tryAlloc(*this, pimpl->queues, texture, bmp, 1);
+        data = textures[best]->tryAlloc(*this, pimpl->queues, textures[best],
+            src, srcX, srcY, srcWidth, srcHeight, borderFlags, 1);
         if (data.get())
             return data;
+        rejected[best] = true;
     }
     
     // All textures are full: Create a new one.
@@ -398,7 +1077,8 @@ std::auto_ptr<Gosu::ImageData> Gosu::Graphics::createImage(
     pimpl->textures.push_back(texture);
     
     std::auto_ptr<ImageData> data;
-    data = texture->tryAlloc(*this, pimpl->queues, texture, bmp, 1);
+    data = texture->tryAlloc(*this, pimpl->queues, texture,
+        src, srcX, srcY, srcWidth, srcHeight, borderFlags, 1);
     if (!data.get())
         throw std::logic_error("Internal texture block allocation error");
 
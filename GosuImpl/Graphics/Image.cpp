@@ -110,6 +110,37 @@ void Gosu::Image::drawRot(double x, double y, ZPos z,
                c, z, mode);
 }
 
+void Gosu::Image::drawSprites(std::size_t count, const float* x, const float* y,
+    const float* scales, const float* angles, const Color* colors,
+    ZPos z, AlphaMode mode) const
+{
+    data->drawSprites(count, x, y, scales, angles, colors, z, mode);
+}
+
+void Gosu::ImageData::drawSprites(std::size_t count, const float* x, const float* y,
+    const float* scales, const float* angles, const Color* colors,
+    ZPos z, AlphaMode mode) const
+{
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        double scale = scales ? scales[i] : 1;
+        double angle = angles ? angles[i] : 0;
+        Color c = colors ? colors[i] : Color::WHITE;
+        
+        // From the center to the rotated top and right edges.
+        double upX = offsetX(angle, height() * scale / 2);
+        double upY = offsetY(angle, height() * scale / 2);
+        double rightX = offsetX(angle + 90, width() * scale / 2);
+        double rightY = offsetY(angle + 90, width() * scale / 2);
+        
+        draw(x[i] - rightX + upX, y[i] - rightY + upY, c,
+             x[i] + rightX + upX, y[i] + rightY + upY, c,
+             x[i] - rightX - upX, y[i] - rightY - upY, c,
+             x[i] + rightX - upX, y[i] + rightY - upY, c,
+             z, mode);
+    }
+}
+
 Gosu::ImageData& Gosu::Image::getData() const
 {
     return *data;
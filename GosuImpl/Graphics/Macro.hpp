@@ -6,17 +6,54 @@
 #include <Gosu/TR1.hpp>
 #include "Common.hpp"
 #include "DrawOpQueue.hpp"
+#include "FrameHash.hpp"
+#include "GLExtensions.hpp"
+#include "GPUTimer.hpp"
 #include <cmath>
 #include <algorithm>
 #include <memory>
 #include <stdexcept>
+#include <vector>
 
 class Gosu::Macro : public Gosu::ImageData
 {
     typedef double Float;
     
     Graphics& graphics;
-    VertexArrays vertexArrays;
+    // Consecutive quads that are drawn with a single glDrawArrays call.
+    struct Batch
+    {
+        RenderState renderState;
+        GLint first;
+        GLsizei count;
+    };
+    
+    // All vertices of the macro in one vertex buffer. It is shared with
+    // scheduled draws, which may run after the macro is gone when rendering
+    // is pipelined.
+    struct Buffer
+    {
+        // Emptied once uploaded.
+        std::vector<ArrayVertex> vertices;
+        std::vector<Batch> batches;
+        GLuint name;
+        // Used to identify frames that draw the same macro.
+        std::tr1::uint64_t serial;
+        
+        Buffer()
+        : name(0), serial(FrameHash::uniqueValue())
+        {
+        }
+        
+        ~Buffer()
+        {
+            #ifndef GOSU_IS_IPHONE
+            if (name != 0)
+                GL::deleteBuffers(1, &name);
+            #endif
+        }
+    };
+    std::tr1::shared_ptr<Buffer> buffer;
     int w, h;
     
     Transform findTransformForTarget(Float x1, Float y1, Float x2, Float y2, Float x3, Float y3, Float x4, Float y4) const
@@ -163,36 +200,74 @@ class Gosu::Macro : public Gosu::ImageData
         return result;
     }
     
-    void drawVertexArrays(Float x1, Float y1, Float x2, Float y2, Float x3, Float y3, Float x4, Float y4) const
+    #ifndef GOSU_IS_IPHONE
+    static void drawBuffer(const std::tr1::shared_ptr<Buffer>& buffer, const Transform& transform)
     {
-        // TODO: Macros should not be split up just because they have different transforms! This is insane.
-        // They should be premultiplied and have the same transform by definition. Then, the transformation
-        // only had to be performed here once.
+        if (buffer->batches.empty())
+            return;
+        
+        GPUTimer::Section gpuSection(GPUTimer::gpMacros);
+        const GLvoid* vertices = 0;
+        loadGLExtensions();
+        if (!GL::bindBuffer)
+            vertices = &buffer->vertices[0];
+        else if (buffer->name == 0)
+        {
+            // Only now is it certain which context (and thread) the macro is
+            // drawn on, so this is where it moves to video memory.
+            GL::genBuffers(1, &buffer->name);
+            GL::bindBuffer(GL_ARRAY_BUFFER, buffer->name);
+            GL::bufferData(GL_ARRAY_BUFFER, buffer->vertices.size() * sizeof(ArrayVertex),
+                &buffer->vertices[0], GL_STATIC_DRAW);
+            std::vector<ArrayVertex>().swap(buffer->vertices);
+        }
+        else
+            GL::bindBuffer(GL_ARRAY_BUFFER, buffer->name);
         
-        #ifndef GOSU_IS_IPHONE
         glEnable(GL_BLEND);
         glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+        glMultMatrixd(&transform[0]);
+        glInterleavedArrays(GL_T2F_C4UB_V3F, 0, vertices);
         
-        Transform transform =
-            findTransformForTarget(x1, y1, x2, y2, x3, y3, x4, y4);
-        
-        for (VertexArrays::const_iterator it = vertexArrays.begin(), end = vertexArrays.end(); it != end; ++it)
+        for (std::size_t i = 0; i < buffer->batches.size(); ++i)
         {
-            glPushMatrix();
-            it->renderState.apply();
-            glMultMatrixd(&transform[0]);
-            glInterleavedArrays(GL_T2F_C4UB_V3F, 0, &it->vertices[0]);
-            glDrawArrays(GL_QUADS, 0, it->vertices.size());
-            glPopMatrix();
+            const Batch& batch = buffer->batches[i];
+            if (i == 0 || batch.renderState.texture != buffer->batches[i - 1].renderState.texture)
+                batch.renderState.applyTexture();
+            if (i == 0 || batch.renderState.mode != buffer->batches[i - 1].renderState.mode)
+                batch.renderState.applyAlphaMode();
+            glDrawArrays(GL_QUADS, batch.first, batch.count);
         }
-        #endif
+        
+        glPopMatrix();
+        if (GL::bindBuffer)
+            GL::bindBuffer(GL_ARRAY_BUFFER, 0);
     }
+    #endif
     
 public:
     Macro(Graphics& graphics, DrawOpQueue& queue, int width, int height)
-    : graphics(graphics), w(width), h(height)
+    : graphics(graphics), buffer(new Buffer), w(width), h(height)
     {
+        VertexArrays vertexArrays;
         queue.compileTo(vertexArrays);
+        
+        std::size_t size = 0;
+        for (std::size_t i = 0; i < vertexArrays.size(); ++i)
+            size += vertexArrays[i].vertices.size();
+        buffer->vertices.reserve(size);
+        
+        for (std::size_t i = 0; i < vertexArrays.size(); ++i)
+        {
+            Batch batch;
+            batch.renderState = vertexArrays[i].renderState;
+            batch.first = buffer->vertices.size();
+            batch.count = vertexArrays[i].vertices.size();
+            buffer->batches.push_back(batch);
+            buffer->vertices.insert(buffer->vertices.end(),
+                vertexArrays[i].vertices.begin(), vertexArrays[i].vertices.end());
+        }
     }
     
     int width() const
@@ -213,8 +288,15 @@ public:
     {
         if (c1 != 0xffffffff || c2 != 0xffffffff || c3 != 0xffffffff || c4 != 0xffffffff)
             throw std::invalid_argument("Macros cannot be tinted with colors yet");
-        std::tr1::function<void()> f = std::tr1::bind(&Macro::drawVertexArrays, this, x1, y1, x2, y2, x3, y3, x4, y4);
-        graphics.scheduleGL(f, z);
+        Transform transform = findTransformForTarget(x1, y1, x2, y2, x3, y3, x4, y4);
+        #ifndef GOSU_IS_IPHONE
+        FrameHash identity;
+        identity.add(buffer->serial);
+        for (int i = 0; i < 16; ++i)
+            identity.add(transform[i]);
+        scheduleGL(graphics, std::tr1::bind(&Macro::drawBuffer, buffer, transform),
+            z, identity.result());
+        #endif
     }
     
     const Gosu::GLTexInfo* glTexInfo() const
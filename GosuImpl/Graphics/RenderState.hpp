@@ -2,7 +2,11 @@
 #define GOSUIMPL_GRAPHICS_RENDERSTATE_HPP
 
 #include "Common.hpp"
+#include "GLExtensions.hpp"
 #include "Texture.hpp"
+#include <Gosu/Inspection.hpp>
+#include <cassert>
+#include <cstring>
 
 // Properties that potentially need to be changed between each draw operation.
 // This does not include the color or vertex data of the actual quads.
@@ -38,6 +42,21 @@ struct Gosu::RenderState
     
     void applyAlphaMode() const
     {
+        #ifndef GOSU_IS_IPHONE
+        // The same colors, but alpha adds up properly when rendering to images.
+        if (GL::blendFuncSeparate)
+        {
+            if (mode == amAdd)
+                GL::blendFuncSeparate(GL_SRC_ALPHA, GL_ONE, GL_ONE, GL_ONE);
+            else if (mode == amMultiply)
+                GL::blendFuncSeparate(GL_DST_COLOR, GL_ZERO, GL_ZERO, GL_ONE);
+            else
+                GL::blendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA,
+                    GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+            return;
+        }
+        #endif
+        
         if (mode == amAdd)
             glBlendFunc(GL_SRC_ALPHA, GL_ONE);
         else if (mode == amMultiply)
@@ -56,26 +75,18 @@ struct Gosu::RenderState
             glScissor(clipRect.x, clipRect.y, clipRect.width, clipRect.height);
         }
     }
-    
-    // Only used by Macro so far
-    #ifndef GOSU_IS_IPHONE
-    void apply() const
-    {
-        applyTexture();
-        // TODO: No inner clipRect yet - how would this work?!
-        applyAlphaMode();
-    }
-    #endif
 };
 
 // Manages the OpenGL rendering state. It caches the current state, only forwarding the
-// changes to OpenGL if the new state is really different.
+// changes to OpenGL if the new state is really different, and counts these changes.
 class Gosu::RenderStateManager : private Gosu::RenderState
 {
     // Not copyable
     RenderStateManager(const RenderStateManager&);
     RenderStateManager& operator=(const RenderStateManager&);
     
+    FrameStats& stats;
+    
     void applyTransform() const
     {
         glMatrixMode(GL_MODELVIEW);
@@ -93,7 +104,8 @@ class Gosu::RenderStateManager : private Gosu::RenderState
     }
     
 public:
-    RenderStateManager()
+    explicit RenderStateManager(FrameStats& stats)
+    : stats(stats)
     {
         applyAlphaMode();
         // Preserve previous MV matrix
@@ -132,6 +144,7 @@ public:
             if (!texture)
                 glEnable(GL_TEXTURE_2D);
             glBindTexture(GL_TEXTURE_2D, newTexture->texName());
+            ++stats.textureBinds;
         }
         else
             // New texture is NO_TEXTURE, disable texturing.
@@ -145,6 +158,7 @@ public:
             return;
         transform = newTransform;
         applyTransform();
+        ++stats.transformChanges;
     }
 
     void setClipRect(const ClipRect& newClipRect)
@@ -156,6 +170,7 @@ public:
             {
                 glDisable(GL_SCISSOR_TEST);
                 clipRect.width = NO_CLIPPING;
+                ++stats.clipChanges;
             }
         }
         else
@@ -166,12 +181,14 @@ public:
                 glEnable(GL_SCISSOR_TEST);
                 clipRect = newClipRect;
                 glScissor(clipRect.x, clipRect.y, clipRect.width, clipRect.height);
+                ++stats.clipChanges;
             }
             // Adjust clipping if necessary
             else if (!(clipRect == newClipRect))
             {
                 clipRect = newClipRect;
                 glScissor(clipRect.x, clipRect.y, clipRect.width, clipRect.height);
+                ++stats.clipChanges;
             }
         }
     }
@@ -182,6 +199,7 @@ public:
             return;
         mode = newMode;
         applyAlphaMode();
+        ++stats.blendChanges;
     }
     
     // The cached values may have been messed with. Reset them again.
@@ -197,14 +215,127 @@ public:
     }
 };
 
+// Interns all render states used during one frame, so that each DrawOp only
+// needs to store a small index, and two ops can be compared by that index.
+class Gosu::RenderStateTable
+{
+    std::vector<RenderState> states;
+    // Open addressing hash table of (index + 1) into states; 0 is empty.
+    std::vector<unsigned> slots;
+    unsigned lastIndex;
+    
+    static std::size_t hashOf(const Texture* texture, const Transform* transform,
+        const ClipRect* clipRect, AlphaMode mode)
+    {
+        std::size_t hash = reinterpret_cast<std::size_t>(texture) / sizeof(void*);
+        hash = hash * 31 + reinterpret_cast<std::size_t>(transform) / sizeof(void*);
+        hash = hash * 31 + mode;
+        if (clipRect)
+        {
+            const double values[4] = { clipRect->x, clipRect->y, clipRect->width, clipRect->height };
+            for (int i = 0; i < 4; ++i)
+            {
+                std::tr1::uint64_t bits;
+                std::memcpy(&bits, &values[i], sizeof bits);
+                hash = hash * 31 + static_cast<std::size_t>(bits ^ (bits >> 32));
+            }
+        }
+        return hash;
+    }
+    
+    static bool matches(const RenderState& state, const Texture* texture,
+        const Transform* transform, const ClipRect* clipRect, AlphaMode mode)
+    {
+        if (state.texture.get() != texture || state.transform != transform || state.mode != mode)
+            return false;
+        if (!clipRect)
+            return state.clipRect.width == NO_CLIPPING;
+        return state.clipRect.width != NO_CLIPPING && state.clipRect == *clipRect;
+    }
+    
+    void grow()
+    {
+        slots.assign(std::max<std::size_t>(64, slots.size() * 2), 0);
+        for (unsigned i = 0; i < states.size(); ++i)
+        {
+            const RenderState& state = states[i];
+            const ClipRect* clipRect = state.clipRect.width == NO_CLIPPING ? 0 : &state.clipRect;
+            std::size_t slot = hashOf(state.texture.get(), state.transform, clipRect, state.mode);
+            while (slots[slot & (slots.size() - 1)] != 0)
+                ++slot;
+            slots[slot & (slots.size() - 1)] = i + 1;
+        }
+    }
+    
+public:
+    RenderStateTable()
+    : lastIndex(0)
+    {
+    }
+    
+    // clipRect == 0 means no clipping.
+    unsigned intern(const std::tr1::shared_ptr<Texture>& texture, const Transform* transform,
+        const ClipRect* clipRect, AlphaMode mode)
+    {
+        // Most of the time, the same state is used over and over again.
+        if (lastIndex < states.size() &&
+            matches(states[lastIndex], texture.get(), transform, clipRect, mode))
+            return lastIndex;
+        
+        if (states.size() * 2 >= slots.size())
+            grow();
+        
+        std::size_t mask = slots.size() - 1;
+        std::size_t slot = hashOf(texture.get(), transform, clipRect, mode);
+        for (; slots[slot & mask] != 0; ++slot)
+            if (matches(states[slots[slot & mask] - 1], texture.get(), transform, clipRect, mode))
+                return lastIndex = slots[slot & mask] - 1;
+        
+        // This is the only place where the texture's reference count is touched.
+        RenderState state;
+        state.texture = texture;
+        state.transform = transform;
+        if (clipRect)
+            state.clipRect = *clipRect;
+        state.mode = mode;
+        states.push_back(state);
+        
+        lastIndex = states.size() - 1;
+        slots[slot & mask] = lastIndex + 1;
+        return lastIndex;
+    }
+    
+    const RenderState& operator[](unsigned index) const
+    {
+        assert (index < states.size());
+        return states[index];
+    }
+    
+    std::size_t size() const
+    {
+        return states.size();
+    }
+    
+    void clear()
+    {
+        states.clear();
+        slots.assign(slots.size(), 0);
+        lastIndex = 0;
+    }
+};
+
 namespace Gosu
 {
+    // Quads of a macro that share a texture and alpha mode, with their
+    // transforms already applied.
     struct VertexArray
     {
         RenderState renderState;
         std::vector<ArrayVertex> vertices;
+        // Bounding box of all vertices.
+        GLfloat left, top, right, bottom;
     };
-    typedef std::list<VertexArray> VertexArrays;    
+    typedef std::vector<VertexArray> VertexArrays;
 }
     
 #endif
\ No newline at end of file
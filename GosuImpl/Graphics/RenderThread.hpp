@@ -0,0 +1,211 @@
+#ifndef GOSUIMPL_GRAPHICS_RENDERTHREAD_HPP
+#define GOSUIMPL_GRAPHICS_RENDERTHREAD_HPP
+
+#include <Gosu/Color.hpp>
+#include <Gosu/Inspection.hpp>
+#include <Gosu/Timing.hpp>
+#include <Gosu/TR1.hpp>
+#include "Common.hpp"
+#include "DrawOpQueue.hpp"
+#include "GPUTimer.hpp"
+#include "StreamingBuffer.hpp"
+#include "../Threading.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+// Performs finished frames on a thread of its own while the main thread
+// already records the next one. At most one frame is in flight; submit()
+// blocks until the previous frame has been presented.
+class Gosu::RenderThread
+{
+    std::tr1::function<void()> setUp, present, tearDown;
+
+    Mutex mutex;
+    ConditionVariable changed;
+
+    // While busy, these belong to the render thread. The frame queues are
+    // performed in order; the retained queues own transforms and GL blocks
+    // that the frame refers to and are only cleared afterwards.
+    DrawOpQueueStack frameQueues, retainedQueues;
+    Color clearColor;
+    // Filled in while the frame is performed.
+    FrameStats stats;
+    bool gpuTiming;
+    // Cleared queues that the main thread can take back.
+    DrawOpQueueStack doneQueues;
+    bool ready, busy, quitting;
+    std::string error;
+
+    // Must be the last member so that everything else is set up when it starts.
+    Thread thread;
+
+    void render(StreamingBuffer& vertexBuffer, GPUTimer& gpuTimer)
+    {
+        glClearColor(clearColor.red() / 255.f, clearColor.green() / 255.f,
+            clearColor.blue() / 255.f, clearColor.alpha() / 255.f);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        for (DrawOpQueueStack::iterator it = frameQueues.begin(); it != frameQueues.end(); ++it)
+            it->performDrawOpsAndCode(vertexBuffer, gpuTimer, stats);
+        vertexBuffer.endFrame();
+        gpuTimer.endFrame(stats);
+
+        std::tr1::uint64_t presentTime = nanoseconds();
+        present();
+        stats.swapWait = (nanoseconds() - presentTime) / 1000000.0;
+    }
+
+    void run()
+    {
+        // Must be destroyed while the context is still current.
+        std::auto_ptr<StreamingBuffer> vertexBuffer;
+        std::auto_ptr<GPUTimer> gpuTimer;
+        bool current = false;
+        try
+        {
+            setUp();
+            current = true;
+            if (!glGetString(GL_VERSION))
+                throw std::runtime_error("No OpenGL context on the render thread");
+            vertexBuffer.reset(new StreamingBuffer);
+            gpuTimer.reset(new GPUTimer);
+        }
+        catch (const std::exception& e)
+        {
+            vertexBuffer.reset();
+            if (current)
+                tearDown();
+            
+            Lock lock(mutex);
+            error = e.what();
+            ready = true;
+            changed.notifyAll();
+            return;
+        }
+        
+        {
+            Lock lock(mutex);
+            ready = true;
+            changed.notifyAll();
+        }
+        
+        for (;;)
+        {
+            bool measureGPU;
+            {
+                Lock lock(mutex);
+                while (!busy && !quitting)
+                    changed.wait(mutex);
+                if (!busy)
+                    break;
+                measureGPU = gpuTiming;
+            }
+
+            try
+            {
+                gpuTimer->setEnabled(measureGPU);
+                render(*vertexBuffer, *gpuTimer);
+            }
+            catch (const std::exception& e)
+            {
+                Lock lock(mutex);
+                error = e.what();
+            }
+
+            for (DrawOpQueueStack::iterator it = frameQueues.begin(); it != frameQueues.end(); ++it)
+                it->clearQueue();
+            for (DrawOpQueueStack::iterator it = retainedQueues.begin(); it != retainedQueues.end(); ++it)
+                it->clearQueue();
+
+            Lock lock(mutex);
+            doneQueues.splice(doneQueues.end(), frameQueues);
+            doneQueues.splice(doneQueues.end(), retainedQueues);
+            busy = false;
+            changed.notifyAll();
+        }
+
+        vertexBuffer.reset();
+        gpuTimer.reset();
+        tearDown();
+    }
+
+public:
+    // setUp is called on the new thread to make a GL context current, present
+    // after each frame, and tearDown before the thread ends. Throws if setUp
+    // fails.
+    RenderThread(const std::tr1::function<void()>& setUp,
+        const std::tr1::function<void()>& present,
+        const std::tr1::function<void()>& tearDown)
+    : setUp(setUp), present(present), tearDown(tearDown), stats(), gpuTiming(false),
+      ready(false), busy(false), quitting(false),
+      thread(std::tr1::bind(&RenderThread::run, this))
+    {
+        Lock lock(mutex);
+        while (!ready)
+            changed.wait(mutex);
+        if (!error.empty())
+            throw std::runtime_error(error);
+    }
+
+    // Waits for the last frame to be presented.
+    ~RenderThread()
+    {
+        {
+            Lock lock(mutex);
+            quitting = true;
+            changed.notifyAll();
+        }
+        thread.join();
+    }
+
+    // Takes over all queues from both lists. Errors that happened while
+    // rendering the previous frame are reported here. frameStats holds what
+    // is already known about the new frame, and is swapped for the complete
+    // stats of the previous one.
+    void submit(DrawOpQueueStack& frame, DrawOpQueueStack& retained, Color clearWithColor,
+        FrameStats& frameStats)
+    {
+        Lock lock(mutex);
+        while (busy)
+            changed.wait(mutex);
+
+        frameQueues.splice(frameQueues.end(), frame);
+        retainedQueues.splice(retainedQueues.end(), retained);
+        clearColor = clearWithColor;
+        std::swap(stats, frameStats);
+        busy = true;
+        changed.notifyAll();
+
+        if (!error.empty())
+        {
+            std::string message;
+            message.swap(error);
+            throw std::runtime_error(message);
+        }
+    }
+
+    // Waits until the frame in flight, if any, has been presented.
+    void finish()
+    {
+        Lock lock(mutex);
+        while (busy)
+            changed.wait(mutex);
+    }
+
+    // Takes effect with the next frame that is submitted.
+    void setGPUTiming(bool enabled)
+    {
+        Lock lock(mutex);
+        gpuTiming = enabled;
+    }
+
+    // Moves the queues of already presented frames into spare.
+    void recycle(DrawOpQueueStack& spare)
+    {
+        Lock lock(mutex);
+        spare.splice(spare.end(), doneQueues);
+    }
+};
+
+#endif
@@ -0,0 +1,271 @@
+#ifndef GOSUIMPL_GRAPHICS_STREAMINGBUFFER_HPP
+#define GOSUIMPL_GRAPHICS_STREAMINGBUFFER_HPP
+
+#include "Common.hpp"
+#include "GLExtensions.hpp"
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+namespace Gosu
+{
+    #ifdef GOSU_IS_IPHONE
+    // The iPhone draws from its own static arrays (see DrawOp::perform).
+    class StreamingBuffer
+    {
+    public:
+        void endFrame() {}
+    };
+    #else
+
+    // Vertex buffer that the draw op queue writes each batch of vertices
+    // into, so that the driver does not have to copy them out of client
+    // memory on every draw call.
+    //
+    // If possible, this is a ring buffer: every map() gets a fresh range that
+    // is mapped without synchronization, and fences make sure that the GPU is
+    // done with a range before it is reused. Drivers without sync objects get
+    // the whole buffer orphaned on every map() instead, and drivers without
+    // vertex buffers get plain client memory.
+    //
+    // Belongs to a single GL context and must only be used while it is current.
+    class StreamingBuffer
+    {
+        StreamingBuffer(const StreamingBuffer&);
+        StreamingBuffer& operator=(const StreamingBuffer&);
+
+        enum Mode { smUndecided, smClientMemory, smOrphaning, smRing };
+        Mode mode;
+
+        GLuint name;
+        // All in vertices.
+        std::size_t capacity, offset, mappedOffset, mappedCount;
+
+        struct Fence
+        {
+            std::size_t begin, end;
+            GL::Sync sync;
+        };
+        std::deque<Fence> fences;
+
+        std::vector<ArrayVertex> clientMemory;
+
+        // Vertices streamed in the current frame, and a slowly decaying
+        // maximum of that number over past frames.
+        std::size_t frameVertices, peakFrameVertices;
+
+        // Enough room for a few frames to be in flight at the same time.
+        static const std::size_t FRAMES_IN_FLIGHT = 3;
+        static const std::size_t MIN_CAPACITY = 64 * 1024;
+
+        void decide()
+        {
+            loadGLExtensions();
+            if (GL::fenceSync && GL::mapBufferRange)
+                mode = smRing;
+            else if (GL::mapBuffer)
+                mode = smOrphaning;
+            else
+                mode = smClientMemory;
+        }
+
+        void deleteFences()
+        {
+            for (std::size_t i = 0; i < fences.size(); ++i)
+                GL::deleteSync(fences[i].sync);
+            fences.clear();
+        }
+
+        // Waits until the GPU is done with all ranges overlapping the given one.
+        // Fences complete in order, so only the newest of these is waited for.
+        void waitFor(std::size_t begin, std::size_t end)
+        {
+            std::size_t done = 0;
+            for (std::size_t i = 0; i < fences.size(); ++i)
+                if (fences[i].begin < end && begin < fences[i].end)
+                    done = i + 1;
+            if (done == 0)
+                return;
+
+            // One second per try; a lost context makes the wait fail instead.
+            while (GL::clientWaitSync(fences[done - 1].sync, GL_SYNC_FLUSH_COMMANDS_BIT,
+                    1000000000) == GL_TIMEOUT_EXPIRED);
+            for (std::size_t i = 0; i < done; ++i)
+                GL::deleteSync(fences[i].sync);
+            fences.erase(fences.begin(), fences.begin() + done);
+        }
+
+        std::size_t wantedCapacity(std::size_t count) const
+        {
+            std::size_t needed = std::max(count, FRAMES_IN_FLIGHT * peakFrameVertices);
+            // Shrink only if far too large, so that the size does not flip-flop.
+            if (name != 0 && capacity >= needed && capacity <= 4 * needed)
+                return capacity;
+            std::size_t result = MIN_CAPACITY;
+            while (result < needed)
+                result *= 2;
+            return result;
+        }
+
+        void allocate(std::size_t newCapacity)
+        {
+            if (name == 0)
+                GL::genBuffers(1, &name);
+            GL::bindBuffer(GL_ARRAY_BUFFER, name);
+            // The driver keeps the old storage alive until pending draws are done.
+            GL::bufferData(GL_ARRAY_BUFFER, newCapacity * sizeof(ArrayVertex), 0, GL_STREAM_DRAW);
+            deleteFences();
+            capacity = newCapacity;
+            offset = 0;
+        }
+
+        ArrayVertex* mapClientMemory(std::size_t count)
+        {
+            mode = smClientMemory;
+            if (clientMemory.size() < count)
+                clientMemory.resize(count);
+            mappedOffset = 0;
+            mappedCount = count;
+            return &clientMemory[0];
+        }
+
+    public:
+        StreamingBuffer()
+        : mode(smUndecided), name(0), capacity(0), offset(0), mappedOffset(0), mappedCount(0),
+          frameVertices(0), peakFrameVertices(0)
+        {
+        }
+
+        ~StreamingBuffer()
+        {
+            deleteFences();
+            if (name != 0)
+                GL::deleteBuffers(1, &name);
+        }
+
+        // Returns room for count vertices, which must be written but never
+        // read, as the memory may be uncached.
+        ArrayVertex* map(std::size_t count)
+        {
+            if (mode == smUndecided)
+                decide();
+            frameVertices += count;
+            if (mode == smClientMemory)
+                return mapClientMemory(count);
+
+            std::size_t newCapacity = wantedCapacity(count);
+            if (newCapacity != capacity)
+                allocate(newCapacity);
+            else
+                GL::bindBuffer(GL_ARRAY_BUFFER, name);
+
+            void* memory;
+            if (mode == smRing)
+            {
+                if (offset + count > capacity)
+                    offset = 0;
+                waitFor(offset, offset + count);
+                memory = GL::mapBufferRange(GL_ARRAY_BUFFER, offset * sizeof(ArrayVertex),
+                    count * sizeof(ArrayVertex),
+                    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+            }
+            else
+            {
+                offset = 0;
+                GL::bufferData(GL_ARRAY_BUFFER, capacity * sizeof(ArrayVertex), 0, GL_STREAM_DRAW);
+                memory = GL::mapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+            }
+
+            if (!memory)
+            {
+                // Give up on buffers for good rather than failing every frame.
+                GL::bindBuffer(GL_ARRAY_BUFFER, 0);
+                return mapClientMemory(count);
+            }
+
+            mappedOffset = offset;
+            mappedCount = count;
+            offset += count;
+            return static_cast<ArrayVertex*>(memory);
+        }
+
+        // Returns what has to be passed to glInterleavedArrays, and leaves the
+        // buffer bound.
+        const GLvoid* unmap()
+        {
+            if (mode == smClientMemory)
+                return &clientMemory[0];
+
+            // If this fails, the contents were lost (e.g. due to a mode switch)
+            // and this batch is drawn with garbage; nothing to be done about it.
+            GL::unmapBuffer(GL_ARRAY_BUFFER);
+            return reinterpret_cast<const GLvoid*>(mappedOffset * sizeof(ArrayVertex));
+        }
+
+        // Must be called before passing the result of unmap() to GL again if
+        // anything else might have bound another buffer in between.
+        void bind()
+        {
+            if (mode != smClientMemory)
+                GL::bindBuffer(GL_ARRAY_BUFFER, name);
+        }
+
+        // Client arrays only work while no buffer is bound.
+        void unbind()
+        {
+            if (mode != smClientMemory)
+                GL::bindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+
+        // Call after the last draw call that used the mapped vertices.
+        void release()
+        {
+            if (mode == smRing && mappedCount > 0)
+            {
+                Fence fence = { mappedOffset, mappedOffset + mappedCount,
+                    GL::fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) };
+                fences.push_back(fence);
+            }
+            mappedCount = 0;
+            unbind();
+        }
+
+        // Calls release() when it goes out of scope, so that the mapped
+        // vertices are fenced even if drawing them throws.
+        class Release
+        {
+            Release(const Release&);
+            Release& operator=(const Release&);
+
+            StreamingBuffer* buffer;
+
+        public:
+            // Does nothing if buffer is 0.
+            explicit Release(StreamingBuffer* buffer)
+            : buffer(buffer)
+            {
+            }
+
+            ~Release()
+            {
+                if (buffer)
+                    buffer->release();
+            }
+        };
+
+        // Updates the statistics that the buffer size is based on.
+        void endFrame()
+        {
+            peakFrameVertices = std::max(frameVertices, peakFrameVertices - peakFrameVertices / 64);
+            frameVertices = 0;
+        }
+
+        std::size_t peakVerticesPerFrame() const
+        {
+            return peakFrameVertices;
+        }
+    };
+    #endif
+}
+
+#endif
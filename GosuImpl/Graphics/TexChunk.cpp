@@ -16,24 +16,39 @@ void Gosu::TexChunk::setTexInfo()
 
 Gosu::TexChunk::TexChunk(Graphics& graphics, DrawOpQueueStack& queues,
     std::tr1::shared_ptr<Texture> texture, int x, int y, int w, int h, int padding)
-: graphics(graphics), queues(queues), texture(texture), x(x), y(y), w(w), h(h), padding(padding)
+: graphics(graphics), queues(queues), texture(texture), x(x), y(y), w(w), h(h), padding(padding),
+  nested(false)
 {
     setTexInfo();
+    texture->registerChunk(this);
 }
 
 Gosu::TexChunk::TexChunk(const TexChunk& parentChunk, int x, int y, int w, int h)
 : graphics(parentChunk.graphics), queues(parentChunk.queues), texture(parentChunk.texture),
-    x(parentChunk.x + x), y(parentChunk.y + y), w(w), h(h), padding(0)
+    x(parentChunk.x + x), y(parentChunk.y + y), w(w), h(h), padding(0), nested(true)
 {
     setTexInfo();
     texture->block(this->x, this->y, this->w, this->h);
+    texture->registerChunk(this);
 }
 
 Gosu::TexChunk::~TexChunk()
 {
+    texture->unregisterChunk(this);
     texture->free(x - padding, y - padding, w + 2 * padding, h + 2 * padding);
 }
 
+void Gosu::TexChunk::relocate(const std::tr1::shared_ptr<Texture>& newTexture,
+    int offsetX, int offsetY)
+{
+    texture->unregisterChunk(this);
+    texture = newTexture;
+    texture->registerChunk(this);
+    x += offsetX;
+    y += offsetY;
+    setTexInfo();
+}
+
 void Gosu::TexChunk::draw(double x1, double y1, Color c1,
     double x2, double y2, Color c2,
     double x3, double y3, Color c3,
@@ -41,8 +56,6 @@ void Gosu::TexChunk::draw(double x1, double y1, Color c1,
     ZPos z, AlphaMode mode) const
 {
     DrawOp op;
-    op.renderState.texture = texture;
-    op.renderState.mode = mode;
     
     reorderCoordinatesIfNecessary(x1, y1, x2, y2, x3, y3, c3, x4, y4, c4);
     
@@ -62,17 +75,38 @@ void Gosu::TexChunk::draw(double x1, double y1, Color c1,
     op.right = info.right;
     op.bottom = info.bottom;
     
-    op.z = z;
-    queues.back().scheduleDrawOp(op);
+    currentQueue(queues).scheduleDrawOp(op, z, texture, mode);
+}
+
+void Gosu::TexChunk::drawSprites(std::size_t count, const float* x, const float* y,
+    const float* scales, const float* angles, const Color* colors,
+    ZPos z, AlphaMode mode) const
+{
+    DrawOp prototype;
+    prototype.left = info.left;
+    prototype.top = info.top;
+    prototype.right = info.right;
+    prototype.bottom = info.bottom;
+    
+    currentQueue(queues).scheduleSprites(prototype, w, h, count, x, y,
+        scales, angles, colors, z, texture, mode);
+}
+
+std::tr1::uint64_t Gosu::TexChunk::textureRevision() const
+{
+    return texture->revision();
 }
 
 const Gosu::GLTexInfo* Gosu::TexChunk::glTexInfo() const
 {
+    // The texture is about to be used outside of Gosu's drawing.
+    texture->commit();
     return &info;
 }
 
 Gosu::Bitmap Gosu::TexChunk::toBitmap() const
 {
+    texture->commit();
     return texture->toBitmap(x, y, w, h);
 }
 
@@ -107,7 +141,10 @@ void Gosu::TexChunk::insert(const Bitmap& original, int x, int y)
         bitmap = &alternate;
     }
     
+    // Or the next commit would overwrite the new pixels with the old ones.
+    texture->commit();
     glBindTexture(GL_TEXTURE_2D, texName());
     glTexSubImage2D(GL_TEXTURE_2D, 0, this->x + x, this->y + y, bitmap->width(), bitmap->height(),
         Color::GL_FORMAT, GL_UNSIGNED_BYTE, bitmap->data());
+    texture->touch();
 }
@@ -5,6 +5,7 @@
 #include <Gosu/ImageData.hpp>
 #include <Gosu/TR1.hpp>
 #include "Common.hpp"
+#include "BlockAllocator.hpp"
 #include <memory>
 #include <vector>
 #include <stdexcept>
@@ -15,6 +16,7 @@ class Gosu::TexChunk : public Gosu::ImageData
     DrawOpQueueStack& queues;
     std::tr1::shared_ptr<Texture> texture;
     int x, y, w, h, padding;
+    bool nested;
     
     // Cached for faster access.
     GLTexInfo info;
@@ -42,11 +44,46 @@ public:
         return info.texName;
     }
     
+    // See Texture::revision.
+    std::tr1::uint64_t textureRevision() const;
+    
+    // Position in the texture, in pixels.
+    int left() const
+    {
+        return x;
+    }
+    
+    int top() const
+    {
+        return y;
+    }
+    
+    // The area that this chunk holds in its texture's allocator, including
+    // the padding.
+    BlockAllocator::Block block() const
+    {
+        return BlockAllocator::Block(x - padding, y - padding, w + 2 * padding, h + 2 * padding);
+    }
+    
+    // Subimages lie within the block of the chunk they were created from.
+    bool isSubimage() const
+    {
+        return nested;
+    }
+    
+    // Moves the chunk by the given offset into another texture, whose
+    // allocator must already account for it.
+    void relocate(const std::tr1::shared_ptr<Texture>& newTexture, int offsetX, int offsetY);
+    
     void draw(double x1, double y1, Color c1,
         double x2, double y2, Color c2,
         double x3, double y3, Color c3,
         double x4, double y4, Color c4,
         ZPos z, AlphaMode mode) const;
+    
+    void drawSprites(std::size_t count, const float* x, const float* y,
+        const float* scales, const float* angles, const Color* colors,
+        ZPos z, AlphaMode mode) const;
         
     const GLTexInfo* glTexInfo() const;
     Gosu::Bitmap toBitmap() const;
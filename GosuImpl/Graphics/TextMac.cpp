@@ -3,6 +3,7 @@
 #if !defined(GOSU_IS_IPHONE) && !defined(__LP64__)
 
 #include <Gosu/Bitmap.hpp>
+#include <Gosu/Inspection.hpp>
 #include <Gosu/Text.hpp>
 #include <Gosu/TR1.hpp>
 #include <Gosu/Math.hpp>
@@ -195,6 +196,7 @@ namespace
 unsigned Gosu::textWidth(const std::wstring& text,
     const std::wstring& fontName, unsigned fontHeight, unsigned fontFlags)
 {
+    TraceZone zone("textWidth");
     if (text.find_first_of(L"\r\n") != std::wstring::npos)
         throw std::invalid_argument("the argument to textWidth cannot contain line breaks");
     
@@ -216,6 +218,7 @@ void Gosu::drawText(Bitmap& bitmap, const std::wstring& text, int x, int y,
     Color c, const std::wstring& fontName, unsigned fontHeight,
     unsigned fontFlags)
 {
+    TraceZone zone("drawText");
     if (text.find_first_of(L"\r\n") != std::wstring::npos)
         throw std::invalid_argument("the argument to drawText cannot contain line breaks");
     
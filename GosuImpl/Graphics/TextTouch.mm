@@ -4,6 +4,7 @@
 
 #include <Gosu/Text.hpp>
 #include <Gosu/Bitmap.hpp>
+#include <Gosu/Inspection.hpp>
 #include <Gosu/Utility.hpp>
 #include <Gosu/Math.hpp>
 #include "../MacUtility.hpp"
@@ -131,6 +132,7 @@ namespace
 unsigned Gosu::textWidth(const wstring& text,
     const wstring& fontName, unsigned fontHeight, unsigned fontFlags)
 {
+    TraceZone zone("textWidth");
     if (text.find_first_of(L"\r\n") != wstring::npos)
         throw std::invalid_argument("the argument to textWidth cannot contain line breaks");
     
@@ -154,6 +156,7 @@ void Gosu::drawText(Bitmap& bitmap, const wstring& text, int x, int y,
     Color c, const wstring& fontName, unsigned fontHeight,
     unsigned fontFlags)
 {
+    TraceZone zone("drawText");
     if (text.find_first_of(L"\r\n") != wstring::npos)
         throw std::invalid_argument("the argument to drawText cannot contain line breaks");
     
@@ -1,5 +1,6 @@
 #include <Gosu/Text.hpp>
 #include <Gosu/Bitmap.hpp>
+#include <Gosu/Inspection.hpp>
 #include <Gosu/Utility.hpp>
 
 #include <pango/pango.h>
@@ -253,6 +254,7 @@ unsigned Gosu::textWidth(const std::wstring& text,
     const std::wstring& fontName, unsigned fontHeight,
     unsigned fontFlags)
 {
+    TraceZone zone("textWidth");
     if (text.find_first_of(L"\r\n") != std::wstring::npos)
         throw std::invalid_argument("the argument to textWidth cannot contain line breaks");
     
@@ -266,6 +268,7 @@ void Gosu::drawText(Bitmap& bitmap, const std::wstring& text, int x, int y,
     Color c, const std::wstring& fontName, unsigned fontHeight,
     unsigned fontFlags)
 {
+    TraceZone zone("drawText");
     if (text.find_first_of(L"\r\n") != std::wstring::npos)
         throw std::invalid_argument("the argument to drawText cannot contain line breaks");
     
@@ -2,6 +2,7 @@
 #include <windows.h>
 
 #include <Gosu/Bitmap.hpp>
+#include <Gosu/Inspection.hpp>
 #include <Gosu/Text.hpp>
 #include <Gosu/Utility.hpp>
 #include <Gosu/WinUtility.hpp>
@@ -145,6 +146,7 @@ namespace Gosu
 unsigned Gosu::textWidth(const std::wstring& text,
     const std::wstring& fontName, unsigned fontHeight, unsigned fontFlags)
 {
+    TraceZone zone("textWidth");
     if (text.find_first_of(L"\r\n") != std::wstring::npos)
         throw std::invalid_argument("the argument to textWidth cannot contain line breaks");
     
@@ -162,6 +164,7 @@ void Gosu::drawText(Bitmap& bitmap, const std::wstring& text, int x, int y,
     Color c, const std::wstring& fontName, unsigned fontHeight,
     unsigned fontFlags)
 {
+    TraceZone zone("drawText");
     if (text.find_first_of(L"\r\n") != std::wstring::npos)
         throw std::invalid_argument("the argument to drawText cannot contain line breaks");
     
@@ -1,17 +1,173 @@
 #include <Gosu/Graphics.hpp>
 #include "Texture.hpp"
 #include "TexChunk.hpp"
+#include "GLExtensions.hpp"
+#include "UploadThread.hpp"
 #include <Gosu/Bitmap.hpp>
+#include <Gosu/Inspection.hpp>
 #include <Gosu/Platform.hpp>
+#include <algorithm>
+#include <functional>
 #include <stdexcept>
+#include <utility>
 
 namespace Gosu
 {
     bool undocumentedRetrofication = false;
 }
 
+namespace
+{
+    // Textures are only created and changed on the main thread.
+    std::tr1::uint64_t lastRevision = 0;
+    unsigned long releaseCount = 0;
+    
+    typedef Gosu::BlockAllocator::Block Block;
+    
+    bool contains(const Block& outer, const Block& inner)
+    {
+        return outer.left <= inner.left && inner.left + inner.width <= outer.left + outer.width &&
+            outer.top <= inner.top && inner.top + inner.height <= outer.top + outer.height;
+    }
+    
+    bool intersect(const Block& a, const Block& b)
+    {
+        return a.left < b.left + b.width && b.left < a.left + a.width &&
+            a.top < b.top + b.height && b.top < a.top + a.height;
+    }
+    
+    // Row by row, so that blocks next to each other end up next to each other.
+    bool readingOrder(const Block& a, const Block& b)
+    {
+        if (a.top != b.top)
+            return a.top < b.top;
+        return a.left < b.left;
+    }
+    
+    // Pixel formats of the staging area. Uploads are fastest in the format
+    // that the driver stores textures in, as it then need not convert them.
+    struct RGBA
+    {
+        static std::tr1::uint32_t convert(Gosu::Color c)
+        {
+            return c.gl();
+        }
+    };
+    
+    struct BGRA
+    {
+        static std::tr1::uint32_t convert(Gosu::Color c)
+        {
+            return c.argb();
+        }
+    };
+    
+    bool driverPrefersBGRA()
+    {
+#ifdef GOSU_IS_IPHONE
+        return false;
+#else
+        Gosu::loadGLExtensions();
+        GLint format = GL_RGBA;
+        if (Gosu::GL::getInternalformativ)
+            Gosu::GL::getInternalformativ(GL_TEXTURE_2D, GL_RGBA8, GL_TEXTURE_IMAGE_FORMAT,
+                1, &format);
+        return format == GL_BGRA;
+#endif
+    }
+    
+    // Like applyBorderFlags, but straight into rows of the staging area: the
+    // padding repeats the outermost pixels on tileable sides and is
+    // transparent on the others.
+    template<typename Format>
+    void stagePixels(std::tr1::uint32_t* firstRow, unsigned rowLength,
+        const Block& block, const Gosu::Bitmap& src, unsigned srcX, unsigned srcY,
+        unsigned borderFlags, unsigned padding)
+    {
+        using namespace Gosu;
+        
+        unsigned srcWidth = block.width - 2 * padding, srcHeight = block.height - 2 * padding;
+        unsigned rightPadding = padding + srcWidth;
+        for (unsigned y = 0; y < block.height; ++y)
+        {
+            std::tr1::uint32_t* row = firstRow + y * rowLength;
+            
+            bool border = y < padding || y >= padding + srcHeight;
+            if (srcWidth == 0 || srcHeight == 0 ||
+                (border && !(borderFlags & (y < padding ? bfTileableTop : bfTileableBottom))))
+            {
+                std::fill(row, row + block.width, 0);
+                continue;
+            }
+            unsigned srcRow = !border ? y - padding : y < padding ? 0 : srcHeight - 1;
+            
+            const Color* srcPixels = src.data() + (srcY + srcRow) * src.width() + srcX;
+            std::tr1::uint32_t left = (borderFlags & bfTileableLeft) ?
+                Format::convert(srcPixels[0]) : 0;
+            std::tr1::uint32_t right = (borderFlags & bfTileableRight) ?
+                Format::convert(srcPixels[srcWidth - 1]) : 0;
+            std::fill(row, row + padding, left);
+            for (unsigned x = 0; x < srcWidth; ++x)
+                row[padding + x] = Format::convert(srcPixels[x]);
+            std::fill(row + rightPadding, row + block.width, right);
+        }
+    }
+    
+    // The staged pixels of a commit and the areas to upload them to, which
+    // may happen on an upload thread. The pixels are whole texture rows
+    // from top on.
+    struct Upload
+    {
+        GLuint name;
+        unsigned size, top;
+        bool bgra;
+        std::tr1::shared_ptr<std::vector<std::tr1::uint32_t> > pixels;
+        std::vector<Block> areas;
+        
+        void uploadArea(const Block& area) const
+        {
+            const std::tr1::uint32_t* areaPixels = &(*pixels)[(area.top - top) * size + area.left];
+#ifdef GOSU_IS_IPHONE
+            // OpenGL ES cannot skip to the next row of the staging area by itself.
+            std::vector<std::tr1::uint32_t> rows;
+            if (area.width != size)
+            {
+                rows.resize(area.width * area.height);
+                for (unsigned y = 0; y < area.height; ++y)
+                    std::copy(areaPixels + y * size, areaPixels + y * size + area.width,
+                        rows.begin() + y * area.width);
+                areaPixels = &rows[0];
+            }
+#else
+            if (bgra)
+            {
+                glTexSubImage2D(GL_TEXTURE_2D, 0, area.left, area.top, area.width, area.height,
+                    GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, areaPixels);
+                return;
+            }
+#endif
+            glTexSubImage2D(GL_TEXTURE_2D, 0, area.left, area.top, area.width, area.height,
+                GL_RGBA, GL_UNSIGNED_BYTE, areaPixels);
+        }
+        
+        void operator()() const
+        {
+            glBindTexture(GL_TEXTURE_2D, name);
+#ifndef GOSU_IS_IPHONE
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, size);
+#endif
+            for (std::size_t i = 0; i < areas.size(); ++i)
+                uploadArea(areas[i]);
+#ifndef GOSU_IS_IPHONE
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+#endif
+        }
+    };
+}
+
 Gosu::Texture::Texture(unsigned size)
-: allocator(size, size)
+: allocator(size, size), rev(++lastRevision), stagedTop(0), bgra(driverPrefersBGRA()),
+  uploadTicket(0)
 {
     // Create texture name.
     glGenTextures(1, &name);
@@ -50,6 +206,7 @@ Gosu::Texture::Texture(unsigned size)
 
 Gosu::Texture::~Texture()
 {
+    finishUploads();
     glDeleteTextures(1, &name);
 }
 
@@ -63,26 +220,202 @@ GLuint Gosu::Texture::texName() const
     return name;
 }
 
+std::tr1::uint64_t Gosu::Texture::revision() const
+{
+    return rev;
+}
+
+void Gosu::Texture::touch()
+{
+    rev = ++lastRevision;
+}
+
+// Makes the staging area cover the rows from top to bottom.
+void Gosu::Texture::stageRows(unsigned top, unsigned bottom)
+{
+    unsigned width = size();
+    if (staging.empty())
+    {
+        stagedTop = top;
+        staging.resize((bottom - top) * width);
+        return;
+    }
+    
+    unsigned stagedBottom = stagedTop + staging.size() / width;
+    if (top < stagedTop)
+    {
+        // Leave as much room above as there already is staged, so that
+        // blocks that are staged further and further up do not copy all
+        // rows each time.
+        unsigned stagedRows = stagedBottom - stagedTop;
+        unsigned newTop = std::min(top, stagedTop > stagedRows ? stagedTop - stagedRows : 0);
+        std::vector<std::tr1::uint32_t> grown((std::max(bottom, stagedBottom) - newTop) * width);
+        std::copy(staging.begin(), staging.end(), grown.begin() + (stagedTop - newTop) * width);
+        staging.swap(grown);
+        stagedTop = newTop;
+    }
+    else if (bottom > stagedBottom)
+    {
+        // Blocks are mostly allocated from the top down. Grow the capacity
+        // geometrically, but not past the bottom of the texture, so that
+        // staging row after row does not copy all rows each time.
+        std::size_t needed = (bottom - stagedTop) * width;
+        if (needed > staging.capacity())
+            staging.reserve(std::min<std::size_t>((width - stagedTop) * width,
+                std::max(needed, staging.capacity() * 2)));
+        staging.resize(needed);
+    }
+}
+
+void Gosu::Texture::stage(const BlockAllocator::Block& block, const Bitmap& src,
+    unsigned srcX, unsigned srcY, unsigned borderFlags, unsigned padding)
+{
+    stageRows(block.top, block.top + block.height);
+    stagedBlocks.push_back(block);
+    
+    std::tr1::uint32_t* firstRow = &staging[(block.top - stagedTop) * size() + block.left];
+    if (bgra)
+        stagePixels<BGRA>(firstRow, size(), block, src, srcX, srcY, borderFlags, padding);
+    else
+        stagePixels<RGBA>(firstRow, size(), block, src, srcX, srcY, borderFlags, padding);
+}
+
 std::auto_ptr<Gosu::TexChunk>
     Gosu::Texture::tryAlloc(Graphics& graphics, DrawOpQueueStack& queues,
-        std::tr1::shared_ptr<Texture> ptr, const Bitmap& bmp, unsigned padding)
+        std::tr1::shared_ptr<Texture> ptr, const Bitmap& src,
+        unsigned srcX, unsigned srcY, unsigned srcWidth, unsigned srcHeight,
+        unsigned borderFlags, unsigned padding)
 {
     std::auto_ptr<Gosu::TexChunk> result;
     
     BlockAllocator::Block block;
-    if (!allocator.alloc(bmp.width(), bmp.height(), block))
+    if (!allocator.alloc(srcWidth + 2 * padding, srcHeight + 2 * padding, block))
         return result;
     
     result.reset(new TexChunk(graphics, queues, ptr, block.left + padding, block.top + padding,
                               block.width - 2 * padding, block.height - 2 * padding, padding));
     
-    glBindTexture(GL_TEXTURE_2D, name);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, block.left, block.top, block.width, block.height,
-                 Color::GL_FORMAT, GL_UNSIGNED_BYTE, bmp.data());
+    TraceZone zone("Texture::stage");
+    stage(block, src, srcX, srcY, borderFlags, padding);
+    touch();
 
     return result;
 }
 
+// stagedBlocks must be sorted in reading order.
+bool Gosu::Texture::isStaged(const BlockAllocator::Block& block) const
+{
+    std::vector<BlockAllocator::Block>::const_iterator i =
+        std::lower_bound(stagedBlocks.begin(), stagedBlocks.end(), block, readingOrder);
+    return i != stagedBlocks.end() && i->left == block.left && i->top == block.top &&
+        i->width == block.width && i->height == block.height;
+}
+
+// Finds the images in the area that were uploaded before, and so must not
+// be overwritten by uploading all of the area. Subimages count as uploaded
+// even if their parent is staged: they hold the same pixels, so this only
+// keeps the parent from being joined with other blocks.
+void Gosu::Texture::findUploaded(const BlockAllocator::Block& area,
+    std::vector<BlockAllocator::Block>& uploaded) const
+{
+    for (std::set<TexChunk*>::const_iterator i = chunks.begin(); i != chunks.end(); ++i)
+    {
+        BlockAllocator::Block block = (*i)->block();
+        if (intersect(block, area) && ((*i)->isSubimage() || !isStaged(block)))
+            uploaded.push_back(block);
+    }
+    std::sort(uploaded.begin(), uploaded.end(), readingOrder);
+}
+
+void Gosu::Texture::commit(const std::tr1::shared_ptr<UploadThread>& thread)
+{
+    if (!thread)
+        finishUploads();
+    if (stagedBlocks.empty())
+        return;
+    
+    TraceZone zone("Texture::commit");
+    std::sort(stagedBlocks.begin(), stagedBlocks.end(), readingOrder);
+    
+    unsigned left = size(), top = size(), right = 0, bottom = 0;
+    for (std::size_t i = 0; i < stagedBlocks.size(); ++i)
+    {
+        const BlockAllocator::Block& block = stagedBlocks[i];
+        left = std::min(left, block.left);
+        top = std::min(top, block.top);
+        right = std::max(right, block.left + block.width);
+        bottom = std::max(bottom, block.top + block.height);
+    }
+    std::vector<BlockAllocator::Block> uploaded;
+    findUploaded(BlockAllocator::Block(left, top, right - left, bottom - top), uploaded);
+    
+    Upload upload;
+    upload.name = name;
+    upload.size = size();
+    upload.top = stagedTop;
+    upload.bgra = bgra;
+    upload.pixels.reset(new std::vector<std::tr1::uint32_t>);
+    upload.pixels->swap(staging);
+    
+    // Only the uploaded blocks that start less than maxHeight rows above an
+    // area can reach into it.
+    unsigned maxHeight = 0;
+    for (std::size_t i = 0; i < uploaded.size(); ++i)
+        maxHeight = std::max(maxHeight, uploaded[i].height);
+    
+    // Join the blocks, row by row, into as few areas as possible without
+    // covering older images. Gaps between the blocks are free, so it does
+    // not matter what is uploaded there.
+    BlockAllocator::Block area = stagedBlocks.front();
+    for (std::size_t i = 1; i < stagedBlocks.size(); ++i)
+    {
+        const BlockAllocator::Block& block = stagedBlocks[i];
+        unsigned joinedLeft = std::min(area.left, block.left);
+        unsigned joinedTop = std::min(area.top, block.top);
+        BlockAllocator::Block joined(joinedLeft, joinedTop,
+            std::max(area.left + area.width, block.left + block.width) - joinedLeft,
+            std::max(area.top + area.height, block.top + block.height) - joinedTop);
+        
+        std::vector<BlockAllocator::Block>::iterator first = std::lower_bound(
+            uploaded.begin(), uploaded.end(), BlockAllocator::Block(0,
+                joined.top > maxHeight ? joined.top - maxHeight : 0, 0, 0), readingOrder);
+        std::vector<BlockAllocator::Block>::iterator last = std::lower_bound(
+            first, uploaded.end(), BlockAllocator::Block(0, joined.top + joined.height, 0, 0),
+            readingOrder);
+        bool overwrites = false;
+        for (; first != last && !overwrites; ++first)
+            overwrites = intersect(*first, joined);
+        if (!overwrites)
+        {
+            area = joined;
+            continue;
+        }
+        upload.areas.push_back(area);
+        area = block;
+    }
+    upload.areas.push_back(area);
+    stagedBlocks.clear();
+    
+    if (!thread)
+    {
+        upload();
+        return;
+    }
+    // Jobs on the same thread run in order, so only the last one counts.
+    if (uploadThread && uploadThread != thread)
+        finishUploads();
+    uploadTicket = thread->schedule(upload);
+    uploadThread = thread;
+}
+
+void Gosu::Texture::finishUploads()
+{
+    if (!uploadThread)
+        return;
+    uploadThread->waitFor(uploadTicket);
+    uploadThread.reset();
+}
+
 void Gosu::Texture::block(unsigned x, unsigned y, unsigned width, unsigned height)
 {
     allocator.block(x, y, width, height);
@@ -91,6 +424,124 @@ void Gosu::Texture::block(unsigned x, unsigned y, unsigned width, unsigned heigh
 void Gosu::Texture::free(unsigned x, unsigned y, unsigned width, unsigned height)
 {
     allocator.free(x, y, width, height);
+    
+    // Images that are gone before their first commit need no upload.
+    for (std::size_t i = 0; i < stagedBlocks.size(); ++i)
+        if (stagedBlocks[i].left == x && stagedBlocks[i].top == y &&
+            stagedBlocks[i].width == width && stagedBlocks[i].height == height)
+        {
+            stagedBlocks[i] = stagedBlocks.back();
+            stagedBlocks.pop_back();
+            if (stagedBlocks.empty())
+                std::vector<std::tr1::uint32_t>().swap(staging);
+            break;
+        }
+    ++releaseCount;
+}
+
+unsigned long Gosu::Texture::releases()
+{
+    return releaseCount;
+}
+
+double Gosu::Texture::occupancy() const
+{
+    return double(allocator.usedArea()) / allocator.width() / allocator.height();
+}
+
+unsigned long Gosu::Texture::freeArea() const
+{
+    return (unsigned long)allocator.width() * allocator.height() - allocator.usedArea();
+}
+
+bool Gosu::Texture::mayFit(unsigned width, unsigned height) const
+{
+    return allocator.mayFit(width, height);
+}
+
+void Gosu::Texture::registerChunk(TexChunk* chunk)
+{
+    chunks.insert(chunk);
+}
+
+void Gosu::Texture::unregisterChunk(TexChunk* chunk)
+{
+    chunks.erase(chunk);
+}
+
+std::size_t Gosu::Texture::chunkCount() const
+{
+    return chunks.size();
+}
+
+bool Gosu::Texture::moveChunksTo(const std::tr1::shared_ptr<Texture>& target)
+{
+#ifdef GOSU_IS_IPHONE
+    return chunks.empty();
+#else
+    TraceZone zone("Texture::moveChunksTo");
+    commit();
+    target->commit();
+    
+    GL::framebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, name, 0);
+    if (GL::checkFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        return chunks.empty();
+    glBindTexture(GL_TEXTURE_2D, target->name);
+    
+    // Largest first, so that chunks come before their subimages.
+    typedef std::pair<unsigned long, TexChunk*> SizedChunk;
+    std::vector<SizedChunk> order;
+    for (std::set<TexChunk*>::const_iterator i = chunks.begin(); i != chunks.end(); ++i)
+    {
+        BlockAllocator::Block block = (*i)->block();
+        order.push_back(SizedChunk((unsigned long)block.width * block.height, *i));
+    }
+    std::sort(order.begin(), order.end(), std::greater<SizedChunk>());
+    
+    // Blocks that were copied, where to, and those that did not fit.
+    std::vector<BlockAllocator::Block> copied, destinations, stuck;
+    for (std::vector<SizedChunk>::const_iterator i = order.begin(); i != order.end(); ++i)
+    {
+        TexChunk& chunk = *i->second;
+        BlockAllocator::Block block = chunk.block(), destination;
+        
+        std::size_t parent = 0;
+        while (parent < copied.size() && !contains(copied[parent], block))
+            ++parent;
+        if (parent < copied.size())
+        {
+            destination = block;
+            destination.left += destinations[parent].left - copied[parent].left;
+            destination.top += destinations[parent].top - copied[parent].top;
+            target->allocator.block(destination.left, destination.top,
+                destination.width, destination.height);
+        }
+        else
+        {
+            bool isStuck = false;
+            for (std::size_t j = 0; j < stuck.size() && !isStuck; ++j)
+                isStuck = contains(stuck[j], block);
+            if (isStuck || !target->allocator.alloc(block.width, block.height, destination))
+            {
+                stuck.push_back(block);
+                continue;
+            }
+            
+            glCopyTexSubImage2D(GL_TEXTURE_2D, 0, destination.left, destination.top,
+                block.left, block.top, block.width, block.height);
+            copied.push_back(block);
+            destinations.push_back(destination);
+        }
+        
+        free(block.left, block.top, block.width, block.height);
+        chunk.relocate(target, int(destination.left) - int(block.left),
+            int(destination.top) - int(block.top));
+    }
+    
+    touch();
+    target->touch();
+    return chunks.empty();
+#endif
 }
 
 Gosu::Bitmap Gosu::Texture::toBitmap(unsigned x, unsigned y, unsigned width, unsigned height) const
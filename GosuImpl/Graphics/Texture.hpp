@@ -7,6 +7,7 @@
 #include "Common.hpp"
 #include "TexChunk.hpp"
 #include "BlockAllocator.hpp"
+#include <set>
 #include <vector>
 
 namespace Gosu
@@ -15,17 +16,73 @@ namespace Gosu
     {
         BlockAllocator allocator;
         GLuint name;
+        std::tr1::uint64_t rev;
+        // Chunks that currently live on this texture.
+        std::set<TexChunk*> chunks;
+        
+        // Pixels of the blocks that were allocated since the last commit, as
+        // whole rows of the texture from stagedTop on. In BGRA order (as
+        // 0xaarrggbb) if the driver prefers that, else in RGBA order.
+        std::vector<std::tr1::uint32_t> staging;
+        unsigned stagedTop;
+        std::vector<BlockAllocator::Block> stagedBlocks;
+        bool bgra;
+        // Set while an upload thread may still be uploading to this texture.
+        std::tr1::shared_ptr<UploadThread> uploadThread;
+        std::tr1::uint64_t uploadTicket;
+        
+        void stageRows(unsigned top, unsigned bottom);
+        void stage(const BlockAllocator::Block& block, const Bitmap& src,
+            unsigned srcX, unsigned srcY, unsigned borderFlags, unsigned padding);
+        bool isStaged(const BlockAllocator::Block& block) const;
+        void findUploaded(const BlockAllocator::Block& area,
+            std::vector<BlockAllocator::Block>& uploaded) const;
 
     public:
         Texture(unsigned size);
         ~Texture();
         unsigned size() const;
         GLuint texName() const;
+        // Changes whenever the contents change; unique among all textures.
+        std::tr1::uint64_t revision() const;
+        void touch();
+        // Allocates room for the given part of the bitmap plus the padding
+        // around it, which is filled as applyBorderFlags would. The pixels
+        // are only staged; commit() uploads them.
         std::auto_ptr<TexChunk> 
             tryAlloc(Graphics& graphics, DrawOpQueueStack& queues,
-                std::tr1::shared_ptr<Texture> ptr, const Bitmap& bmp, unsigned padding);
+                std::tr1::shared_ptr<Texture> ptr, const Bitmap& src,
+                unsigned srcX, unsigned srcY, unsigned srcWidth, unsigned srcHeight,
+                unsigned borderFlags, unsigned padding);
+        // Uploads everything staged since the last commit, in one call if
+        // possible. Must happen before the texture is drawn or read.
+        // Given an upload thread, only hands the pixels over to it; the
+        // next commit without one waits for them to arrive.
+        void commit(const std::tr1::shared_ptr<UploadThread>& thread =
+            std::tr1::shared_ptr<UploadThread>());
+        // Waits for uploads that are in flight on an upload thread.
+        void finishUploads();
         void block(unsigned x, unsigned y, unsigned width, unsigned height);
         void free(unsigned x, unsigned y, unsigned width, unsigned height);
+        
+        // Counts calls to free() on all textures, so that callers can tell
+        // whether any texture became emptier since they last looked.
+        static unsigned long releases();
+        // Fraction of the texture that is allocated.
+        double occupancy() const;
+        // Summary of the free space, to rule out textures quickly: tryAlloc
+        // fails for bitmaps that mayFit returns false for.
+        unsigned long freeArea() const;
+        bool mayFit(unsigned width, unsigned height) const;
+        
+        void registerChunk(TexChunk* chunk);
+        void unregisterChunk(TexChunk* chunk);
+        std::size_t chunkCount() const;
+        // Moves as many chunks as fit from this texture into target, copying
+        // their pixels on the GPU through the currently bound framebuffer.
+        // Chunks that lie within others (i.e. subimages) move along with
+        // them. Returns true if no chunks are left.
+        bool moveChunksTo(const std::tr1::shared_ptr<Texture>& target);
         Gosu::Bitmap toBitmap(unsigned x, unsigned y, unsigned width, unsigned height) const;
     };
 }
@@ -0,0 +1,563 @@
+#include <Gosu/Tilemap.hpp>
+#include <Gosu/Graphics.hpp>
+#include <Gosu/Image.hpp>
+#include <Gosu/ImageData.hpp>
+#include "Common.hpp"
+#include "DrawOpQueue.hpp"
+#include "FrameHash.hpp"
+#include "GLExtensions.hpp"
+#include "RenderState.hpp"
+#include "TexChunk.hpp"
+#include "../Threading.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace Gosu
+{
+    namespace
+    {
+        // Width and height of a chunk, in tiles.
+        const unsigned CHUNK_SIZE = 32;
+
+        // Positions are relative to the chunk, so shorts are enough.
+        struct TileVertex
+        {
+            GLfloat texCoords[2];
+            GLshort vertices[2];
+        };
+
+        // Consecutive vertices of a chunk that use the same texture.
+        struct Range
+        {
+            GLuint texName;
+            GLint first;
+            GLsizei count;
+        };
+
+        // Either the complete contents of a chunk, or the four vertices of a
+        // single tile that starts at vertex 'first'.
+        struct Upload
+        {
+            unsigned chunk;
+            bool complete;
+            GLint first;
+            std::vector<TileVertex> vertices;
+            std::vector<Range> ranges;
+        };
+
+        // The video memory side of a tilemap. It is only touched by scheduled
+        // GL code, which may run on a render thread; updates are passed in
+        // through a locked list.
+        class ChunkRenderer
+        {
+            struct Chunk
+            {
+                GLuint buffer;
+                // Only used if vertex buffers are not supported.
+                std::vector<TileVertex> vertices;
+                std::vector<Range> ranges;
+                
+                Chunk()
+                : buffer(0)
+                {
+                }
+            };
+            std::vector<Chunk> chunks;
+            unsigned chunksX, chunksY, chunkWidth, chunkHeight;
+
+            Mutex mutex;
+            std::vector<Upload> pending;
+
+            #ifndef GOSU_IS_IPHONE
+            void apply(Upload& upload)
+            {
+                Chunk& chunk = chunks[upload.chunk];
+                if (!GL::bindBuffer)
+                {
+                    if (upload.complete)
+                        chunk.vertices.swap(upload.vertices);
+                    else
+                        std::copy(upload.vertices.begin(), upload.vertices.end(),
+                            chunk.vertices.begin() + upload.first);
+                }
+                else if (upload.complete)
+                {
+                    if (chunk.buffer == 0)
+                        GL::genBuffers(1, &chunk.buffer);
+                    GL::bindBuffer(GL_ARRAY_BUFFER, chunk.buffer);
+                    GL::bufferData(GL_ARRAY_BUFFER, upload.vertices.size() * sizeof(TileVertex),
+                        upload.vertices.empty() ? 0 : &upload.vertices[0], GL_STATIC_DRAW);
+                }
+                else
+                {
+                    GL::bindBuffer(GL_ARRAY_BUFFER, chunk.buffer);
+                    GL::bufferSubData(GL_ARRAY_BUFFER, upload.first * sizeof(TileVertex),
+                        upload.vertices.size() * sizeof(TileVertex), &upload.vertices[0]);
+                }
+
+                if (upload.complete)
+                    chunk.ranges.swap(upload.ranges);
+            }
+
+            // Returns the chunks that intersect the viewport (and the scissor
+            // box, if any), given the current modelview matrix.
+            void findVisibleChunks(unsigned& left, unsigned& top,
+                unsigned& right, unsigned& bottom) const
+            {
+                left = top = 0;
+                right = chunksX, bottom = chunksY;
+
+                GLdouble m[16];
+                glGetDoublev(GL_MODELVIEW_MATRIX, m);
+                // Leave projective transforms to OpenGL.
+                if (m[3] != 0 || m[7] != 0 || m[15] != 1)
+                    return;
+                double det = m[0] * m[5] - m[4] * m[1];
+                if (det == 0)
+                {
+                    right = bottom = 0;
+                    return;
+                }
+
+                // The projection maps the viewport 1:1 to pixels, with y=0 at the top.
+                GLint viewport[4];
+                glGetIntegerv(GL_VIEWPORT, viewport);
+                double screenLeft = 0, screenRight = viewport[2];
+                double screenTop = 0, screenBottom = viewport[3];
+                if (glIsEnabled(GL_SCISSOR_TEST))
+                {
+                    GLint box[4];
+                    glGetIntegerv(GL_SCISSOR_BOX, box);
+                    screenLeft = std::max<double>(screenLeft, box[0]);
+                    screenRight = std::min<double>(screenRight, box[0] + box[2]);
+                    screenTop = std::max<double>(screenTop, viewport[3] - box[1] - box[3]);
+                    screenBottom = std::min<double>(screenBottom, viewport[3] - box[1]);
+                }
+
+                // Map the corners of the screen back into the map.
+                double minX = 0, maxX = 0, minY = 0, maxY = 0;
+                for (int i = 0; i < 4; ++i)
+                {
+                    double sx = (i % 2 ? screenRight : screenLeft) - m[12];
+                    double sy = (i / 2 ? screenBottom : screenTop) - m[13];
+                    double x = (m[5] * sx - m[4] * sy) / det;
+                    double y = (m[0] * sy - m[1] * sx) / det;
+                    if (i == 0)
+                        minX = maxX = x, minY = maxY = y;
+                    else
+                    {
+                        minX = std::min(minX, x), maxX = std::max(maxX, x);
+                        minY = std::min(minY, y), maxY = std::max(maxY, y);
+                    }
+                }
+
+                left = static_cast<unsigned>(std::max(0.0,
+                    std::floor(minX / chunkWidth)));
+                top = static_cast<unsigned>(std::max(0.0,
+                    std::floor(minY / chunkHeight)));
+                right = static_cast<unsigned>(std::max(0.0, std::min<double>(chunksX,
+                    std::floor(maxX / chunkWidth) + 1)));
+                bottom = static_cast<unsigned>(std::max(0.0, std::min<double>(chunksY,
+                    std::floor(maxY / chunkHeight) + 1)));
+            }
+            #endif
+
+        public:
+            ChunkRenderer(unsigned chunksX, unsigned chunksY,
+                unsigned chunkWidth, unsigned chunkHeight)
+            : chunksX(chunksX), chunksY(chunksY), chunkWidth(chunkWidth), chunkHeight(chunkHeight)
+            {
+                chunks.resize(chunksX * chunksY);
+            }
+
+            ~ChunkRenderer()
+            {
+                #ifndef GOSU_IS_IPHONE
+                for (std::size_t i = 0; i < chunks.size(); ++i)
+                    if (chunks[i].buffer != 0)
+                        GL::deleteBuffers(1, &chunks[i].buffer);
+                #endif
+            }
+
+            void schedule(std::vector<Upload>& uploads)
+            {
+                Lock lock(mutex);
+                if (pending.empty())
+                    pending.swap(uploads);
+                else
+                    pending.insert(pending.end(), uploads.begin(), uploads.end());
+                uploads.clear();
+            }
+
+            void draw(double x, double y, Color c, AlphaMode mode)
+            {
+                #ifndef GOSU_IS_IPHONE
+                loadGLExtensions();
+
+                std::vector<Upload> uploads;
+                {
+                    Lock lock(mutex);
+                    uploads.swap(pending);
+                }
+                for (std::size_t i = 0; i < uploads.size(); ++i)
+                    apply(uploads[i]);
+
+                RenderState renderState;
+                renderState.mode = mode;
+                glEnable(GL_BLEND);
+                renderState.applyAlphaMode();
+                glEnable(GL_TEXTURE_2D);
+                glColor4ub(c.red(), c.green(), c.blue(), c.alpha());
+
+                glMatrixMode(GL_MODELVIEW);
+                glTranslated(x, y, 0);
+                unsigned left, top, right, bottom;
+                findVisibleChunks(left, top, right, bottom);
+
+                glEnableClientState(GL_VERTEX_ARRAY);
+                glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+                glDisableClientState(GL_COLOR_ARRAY);
+
+                GLuint boundTexture = NO_TEXTURE;
+                for (unsigned cy = top; cy < bottom; ++cy)
+                    for (unsigned cx = left; cx < right; ++cx)
+                    {
+                        const Chunk& chunk = chunks[cy * chunksX + cx];
+                        if (chunk.ranges.empty())
+                            continue;
+
+                        const char* base = 0;
+                        if (GL::bindBuffer)
+                            GL::bindBuffer(GL_ARRAY_BUFFER, chunk.buffer);
+                        else
+                            base = reinterpret_cast<const char*>(&chunk.vertices[0]);
+                        glTexCoordPointer(2, GL_FLOAT, sizeof(TileVertex),
+                            base + offsetof(TileVertex, texCoords));
+                        glVertexPointer(2, GL_SHORT, sizeof(TileVertex),
+                            base + offsetof(TileVertex, vertices));
+
+                        glPushMatrix();
+                        glTranslated(cx * chunkWidth, cy * chunkHeight, 0);
+                        for (std::size_t i = 0; i < chunk.ranges.size(); ++i)
+                        {
+                            const Range& range = chunk.ranges[i];
+                            if (range.texName != boundTexture)
+                                glBindTexture(GL_TEXTURE_2D, boundTexture = range.texName);
+                            glDrawArrays(GL_QUADS, range.first, range.count);
+                        }
+                        glPopMatrix();
+                    }
+
+                if (GL::bindBuffer)
+                    GL::bindBuffer(GL_ARRAY_BUFFER, 0);
+                glDisableClientState(GL_VERTEX_ARRAY);
+                glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+                #endif
+            }
+        };
+    }
+}
+
+struct Gosu::Tilemap::Impl
+{
+    Graphics& graphics;
+    std::vector<Image> tileset;
+    std::vector<GLTexInfo> texInfos;
+    unsigned width, height, tileWidth, tileHeight, chunksX, chunksY;
+    std::vector<int> tiles;
+
+    // For every cell, the first vertex of its tile in its chunk's vertices.
+    std::vector<GLint> firstVertex;
+    // Chunks that need to be rebuilt, and cells whose vertices can simply be
+    // overwritten.
+    std::vector<bool> dirtyChunks;
+    std::vector<unsigned> dirtyChunkList, changedCells;
+    std::vector<Upload> uploads;
+
+    std::tr1::shared_ptr<ChunkRenderer> renderer;
+
+    // One tile per texture that the tileset uses, to find out if any of them
+    // changed, and a number that changes whenever the map does.
+    std::vector<const TexChunk*> textures;
+    std::vector<std::tr1::uint64_t> textureRevisions;
+    std::tr1::uint64_t revision;
+
+    Impl(Graphics& graphics)
+    : graphics(graphics), revision(FrameHash::uniqueValue())
+    {
+    }
+
+    unsigned chunkOfCell(unsigned cell) const
+    {
+        return cell / width / CHUNK_SIZE * chunksX + cell % width / CHUNK_SIZE;
+    }
+
+    void markChunkDirty(unsigned chunk)
+    {
+        if (dirtyChunks[chunk])
+            return;
+        dirtyChunks[chunk] = true;
+        dirtyChunkList.push_back(chunk);
+    }
+
+    void findTextures()
+    {
+        textures.clear();
+        textureRevisions.clear();
+        for (std::size_t i = 0; i < texInfos.size(); ++i)
+        {
+            bool newTexture = true;
+            for (std::size_t j = 0; j < i; ++j)
+                if (texInfos[j].texName == texInfos[i].texName)
+                    newTexture = false;
+            const TexChunk* chunk = dynamic_cast<const TexChunk*>(&tileset[i].getData());
+            if (newTexture && chunk)
+            {
+                textures.push_back(chunk);
+                textureRevisions.push_back(chunk->textureRevision());
+            }
+        }
+    }
+
+    // Tiles can be moved to other textures by Graphics::compactTextures,
+    // which touches both textures. Rebuilds everything if that happened.
+    void checkTexInfos()
+    {
+        bool touched = false;
+        for (std::size_t i = 0; i < textures.size(); ++i)
+            touched = touched || textures[i]->textureRevision() != textureRevisions[i];
+        if (!touched)
+            return;
+
+        bool moved = false;
+        for (std::size_t i = 0; i < tileset.size(); ++i)
+        {
+            const GLTexInfo& info = *tileset[i].getData().glTexInfo();
+            GLTexInfo& old = texInfos[i];
+            if (info.texName != old.texName || info.left != old.left || info.top != old.top)
+            {
+                old = info;
+                moved = true;
+            }
+        }
+        findTextures();
+        if (moved)
+            for (unsigned chunk = 0; chunk < chunksX * chunksY; ++chunk)
+                markChunkDirty(chunk);
+    }
+
+    void writeTile(unsigned cell, TileVertex* result) const
+    {
+        const GLTexInfo& info = texInfos[tiles[cell]];
+        GLshort x = cell % width % CHUNK_SIZE * tileWidth;
+        GLshort y = cell / width % CHUNK_SIZE * tileHeight;
+        GLshort w = tileWidth, h = tileHeight;
+
+        TileVertex vertices[4] = {
+            { { info.left, info.top }, { x, y } },
+            { { info.right, info.top }, { GLshort(x + w), y } },
+            { { info.right, info.bottom }, { GLshort(x + w), GLshort(y + h) } },
+            { { info.left, info.bottom }, { x, GLshort(y + h) } }
+        };
+        std::copy(vertices, vertices + 4, result);
+    }
+
+    void rebuildChunk(unsigned chunk)
+    {
+        unsigned left = chunk % chunksX * CHUNK_SIZE, top = chunk / chunksX * CHUNK_SIZE;
+        unsigned right = std::min(left + CHUNK_SIZE, width);
+        unsigned bottom = std::min(top + CHUNK_SIZE, height);
+
+        // Sort the tiles by texture so that each texture is bound only once.
+        std::vector<std::pair<GLuint, unsigned> > cells;
+        for (unsigned y = top; y < bottom; ++y)
+            for (unsigned x = left; x < right; ++x)
+            {
+                unsigned cell = y * width + x;
+                firstVertex[cell] = -1;
+                if (tiles[cell] != NO_TILE)
+                    cells.push_back(std::make_pair(texInfos[tiles[cell]].texName, cell));
+            }
+        std::sort(cells.begin(), cells.end());
+
+        uploads.push_back(Upload());
+        Upload& upload = uploads.back();
+        upload.chunk = chunk;
+        upload.complete = true;
+        upload.first = 0;
+        upload.vertices.resize(cells.size() * 4);
+        for (std::size_t i = 0; i < cells.size(); ++i)
+        {
+            if (i == 0 || cells[i].first != cells[i - 1].first)
+            {
+                Range range = { cells[i].first, GLint(i * 4), 0 };
+                upload.ranges.push_back(range);
+            }
+            upload.ranges.back().count += 4;
+            firstVertex[cells[i].second] = i * 4;
+            writeTile(cells[i].second, &upload.vertices[i * 4]);
+        }
+    }
+
+    void updateCell(unsigned cell)
+    {
+        uploads.push_back(Upload());
+        Upload& upload = uploads.back();
+        upload.chunk = chunkOfCell(cell);
+        upload.complete = false;
+        upload.first = firstVertex[cell];
+        upload.vertices.resize(4);
+        writeTile(cell, &upload.vertices[0]);
+    }
+
+    // Turns all changes since the last draw into uploads for the renderer.
+    void flushChanges()
+    {
+        for (std::size_t i = 0; i < changedCells.size(); ++i)
+            if (!dirtyChunks[chunkOfCell(changedCells[i])])
+                updateCell(changedCells[i]);
+        changedCells.clear();
+
+        for (std::size_t i = 0; i < dirtyChunkList.size(); ++i)
+        {
+            rebuildChunk(dirtyChunkList[i]);
+            dirtyChunks[dirtyChunkList[i]] = false;
+        }
+        dirtyChunkList.clear();
+
+        if (!uploads.empty())
+        {
+            renderer->schedule(uploads);
+            revision = FrameHash::uniqueValue();
+        }
+    }
+
+    // What the renderer draws, for skipping identical frames.
+    std::tr1::uint64_t identity(double x, double y, Color c, AlphaMode mode) const
+    {
+        FrameHash hash;
+        hash.add(revision);
+        for (std::size_t i = 0; i < textures.size(); ++i)
+            hash.add(textures[i]->textureRevision());
+        hash.add(x), hash.add(y);
+        hash.add(std::tr1::uint64_t(c.argb()) << 8 | mode);
+        return hash.result();
+    }
+};
+
+const int Gosu::Tilemap::NO_TILE;
+
+Gosu::Tilemap::Tilemap(Graphics& graphics, const std::vector<Image>& tileset,
+    unsigned width, unsigned height)
+: pimpl(new Impl(graphics))
+{
+    if (tileset.empty())
+        throw std::invalid_argument("Tilemaps need at least one tile");
+
+    pimpl->tileset = tileset;
+    pimpl->tileWidth = tileset.front().width();
+    pimpl->tileHeight = tileset.front().height();
+    for (std::size_t i = 0; i < tileset.size(); ++i)
+    {
+        const GLTexInfo* info = tileset[i].getData().glTexInfo();
+        if (!info)
+            throw std::invalid_argument("Tilemap tiles must fit into a single texture");
+        if (tileset[i].width() != pimpl->tileWidth || tileset[i].height() != pimpl->tileHeight)
+            throw std::invalid_argument("Tilemap tiles must all have the same size");
+        pimpl->texInfos.push_back(*info);
+    }
+    pimpl->findTextures();
+    // Vertex positions within a chunk are stored as shorts.
+    if (CHUNK_SIZE * std::max(pimpl->tileWidth, pimpl->tileHeight) > 32767)
+        throw std::invalid_argument("Tilemap tiles are too large");
+
+    pimpl->width = width;
+    pimpl->height = height;
+    pimpl->chunksX = (width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    pimpl->chunksY = (height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    pimpl->tiles.resize(width * height, NO_TILE);
+    pimpl->firstVertex.resize(width * height, -1);
+    pimpl->dirtyChunks.resize(pimpl->chunksX * pimpl->chunksY);
+    pimpl->renderer.reset(new ChunkRenderer(pimpl->chunksX, pimpl->chunksY,
+        CHUNK_SIZE * pimpl->tileWidth, CHUNK_SIZE * pimpl->tileHeight));
+}
+
+unsigned Gosu::Tilemap::width() const
+{
+    return pimpl->width;
+}
+
+unsigned Gosu::Tilemap::height() const
+{
+    return pimpl->height;
+}
+
+unsigned Gosu::Tilemap::tileWidth() const
+{
+    return pimpl->tileWidth;
+}
+
+unsigned Gosu::Tilemap::tileHeight() const
+{
+    return pimpl->tileHeight;
+}
+
+int Gosu::Tilemap::tile(unsigned x, unsigned y) const
+{
+    if (x >= pimpl->width || y >= pimpl->height)
+        throw std::out_of_range("Tile position outside of the map");
+    return pimpl->tiles[y * pimpl->width + x];
+}
+
+void Gosu::Tilemap::setTile(unsigned x, unsigned y, int tile)
+{
+    if (x >= pimpl->width || y >= pimpl->height)
+        throw std::out_of_range("Tile position outside of the map");
+    if (tile != NO_TILE && (tile < 0 || tile >= static_cast<int>(pimpl->tileset.size())))
+        throw std::out_of_range("Tile index outside of the tileset");
+
+    unsigned cell = y * pimpl->width + x;
+    int old = pimpl->tiles[cell];
+    if (old == tile)
+        return;
+    pimpl->tiles[cell] = tile;
+
+    // The vertices can be overwritten in place if the tile stays in the same
+    // run of vertices; otherwise, the chunk is rebuilt.
+    if (old != NO_TILE && tile != NO_TILE &&
+        pimpl->texInfos[old].texName == pimpl->texInfos[tile].texName &&
+        pimpl->firstVertex[cell] >= 0)
+        pimpl->changedCells.push_back(cell);
+    else
+        pimpl->markChunkDirty(pimpl->chunkOfCell(cell));
+}
+
+void Gosu::Tilemap::draw(double x, double y, ZPos z, Color c, AlphaMode mode) const
+{
+    #ifdef GOSU_IS_IPHONE
+    // No custom GL on the iPhone; draw the visible tiles one by one.
+    double tw = pimpl->tileWidth, th = pimpl->tileHeight;
+    unsigned left = static_cast<unsigned>(std::max(0.0, std::floor(-x / tw)));
+    unsigned top = static_cast<unsigned>(std::max(0.0, std::floor(-y / th)));
+    unsigned right = static_cast<unsigned>(std::max(0.0, std::min<double>(pimpl->width,
+        std::ceil((pimpl->graphics.width() - x) / tw))));
+    unsigned bottom = static_cast<unsigned>(std::max(0.0, std::min<double>(pimpl->height,
+        std::ceil((pimpl->graphics.height() - y) / th))));
+    for (unsigned ty = top; ty < bottom; ++ty)
+        for (unsigned tx = left; tx < right; ++tx)
+        {
+            int index = pimpl->tiles[ty * pimpl->width + tx];
+            if (index != NO_TILE)
+                pimpl->tileset[index].draw(x + tx * tw, y + ty * th, z, 1, 1, c, mode);
+        }
+    #else
+    pimpl->checkTexInfos();
+    pimpl->flushChanges();
+    scheduleGL(pimpl->graphics, std::tr1::bind(&ChunkRenderer::draw, pimpl->renderer,
+        x, y, c, mode), z, pimpl->identity(x, y, c, mode));
+    #endif
+}
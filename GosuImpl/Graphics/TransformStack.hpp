@@ -2,97 +2,147 @@
 #define GOSUIMPL_GRAPHICS_TRANSFORMSTACK_HPP
 
 #include "Common.hpp"
-#include <cassert>
 #include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <deque>
+#include <vector>
 
 namespace Gosu
 {
     class TransformStack
     {
-        // All the matrices that are pushed right now.
-        Transforms individual;
         // All the absolute matrices that have been created since last reset.
-        Transforms absolute;
-        // Points to one absolute transform.
-        Transforms::const_iterator currentIterator;
-        
-        void makeCurrent(const Transform& transform)
+        // Equal matrices are only stored once, so that render states can
+        // compare transforms by address. A deque never moves its elements,
+        // and elements past 'used' are kept around to be overwritten after
+        // the next reset.
+        std::deque<Transform> absolute;
+        std::size_t used;
+
+        // Open addressing hash table of (index + 1) into absolute; 0 is empty.
+        std::vector<unsigned> slots;
+
+        // Indices of the absolute (cumulative) transforms that are pushed
+        // right now. The front is the base transform.
+        std::vector<unsigned> stack;
+
+        static std::size_t hashOf(const Transform& transform)
+        {
+            // 0x9e3779b97f4a7c15 and 0xff51afd7ed558ccd, written so that they
+            // need no long long literals.
+            const std::tr1::uint64_t golden = std::tr1::uint64_t(0x9e3779b9) << 32 | 0x7f4a7c15;
+            const std::tr1::uint64_t mixer = std::tr1::uint64_t(0xff51afd7) << 32 | 0xed558ccd;
+            
+            std::tr1::uint64_t hash = 0;
+            for (int i = 0; i < 16; ++i)
+            {
+                std::tr1::uint64_t bits;
+                std::memcpy(&bits, &transform[i], sizeof bits);
+                hash = (hash ^ bits) * golden;
+            }
+            // Matrices often only differ in the topmost bits of a translation
+            // (small integers have no low mantissa bits), so these need to be
+            // mixed down into the bits that select a slot.
+            hash ^= hash >> 33;
+            hash *= mixer;
+            hash ^= hash >> 33;
+            return static_cast<std::size_t>(hash);
+        }
+
+        void insertIntoSlots(unsigned index)
         {
-            currentIterator =
-                std::find(absolute.begin(), absolute.end(), transform);
-            if (currentIterator == absolute.end())
-                currentIterator = absolute.insert(absolute.end(), transform);
+            std::size_t mask = slots.size() - 1;
+            std::size_t slot = hashOf(absolute[index]);
+            while (slots[slot & mask] != 0)
+                ++slot;
+            slots[slot & mask] = index + 1;
         }
-        
+
+        void grow()
+        {
+            slots.assign(std::max<std::size_t>(64, slots.size() * 2), 0);
+            for (unsigned i = 0; i < used; ++i)
+                insertIntoSlots(i);
+        }
+
+        unsigned intern(const Transform& transform)
+        {
+            if (used * 2 >= slots.size())
+                grow();
+
+            std::size_t mask = slots.size() - 1;
+            std::size_t slot = hashOf(transform);
+            for (; slots[slot & mask] != 0; ++slot)
+                if (absolute[slots[slot & mask] - 1] == transform)
+                    return slots[slot & mask] - 1;
+
+            if (used < absolute.size())
+                absolute[used] = transform;
+            else
+                absolute.push_back(transform);
+            slots[slot & mask] = used + 1;
+            return used++;
+        }
+
     public:
         TransformStack()
+        : used(0)
         {
+            absolute.push_back(scale(1));
             reset();
-            individual.front() = absolute.front() = scale(1);
         }
-                
+
         void reset()
         {
             // Every queue has a base transform that is always the current transform.
             // This keeps the code a bit more uniform, and allows the window to
             // set a base transform in the main rendering queue.
-            individual.resize(1);
-            absolute.resize(1);
-            currentIterator = absolute.begin();
+            used = 0;
+            slots.assign(slots.size(), 0);
+            stack.assign(1, intern(absolute.front()));
         }
-        
-        TransformStack(const TransformStack& other)
+
+        void setBaseTransform(const Transform& baseTransform)
         {
-            *this = other;
+            assert (stack.size() == 1);
+            assert (used == 1);
+
+            absolute.front() = baseTransform;
+            reset();
         }
-        
-        // Custom assignment to ensure valid currentIterator
-        TransformStack& operator=(const TransformStack &other)
+
+        const Transform& base() const
         {
-            individual = other.individual;
-            absolute = other.absolute;
-            
-            // Reset our currentIterator to point to the respective element
-            // in our own 'absolute' transforms by iterating both lists up to
-            // the other lists' current iterator
-            currentIterator = absolute.begin();
-            Transforms::const_iterator otherIterator = other.absolute.begin();
-            while (otherIterator != other.currentIterator)
-                ++currentIterator, ++otherIterator;
-            
-            return *this;
+            return absolute.front();
         }
-        
-        void setBaseTransform(const Transform& baseTransform)
+
+        const Transform& current() const
         {
-            assert (individual.size() == 1);
-            assert (absolute.size() == 1);
-            
-            individual.front() = absolute.front() = baseTransform;
+            return absolute[stack.back()];
         }
-        
-        const Transform& current()
+
+        // Resets this stack to the base transform and all pushed transforms
+        // of another stack, which may not be the same object.
+        void continueFrom(const TransformStack& other)
         {
-            return *currentIterator;
+            absolute.front() = other.base();
+            reset();
+            for (std::size_t i = 1; i < other.stack.size(); ++i)
+                stack.push_back(intern(other.absolute[other.stack[i]]));
         }
-        
+
         void push(const Transform& transform)
         {
-            individual.push_back(transform);
-            Transform result = multiply(transform, current());
-            makeCurrent(result);
+            stack.push_back(intern(multiply(transform, current())));
         }
-        
+
         void pop()
         {
-            assert (individual.size() > 1);
-            
-            individual.pop_back();
-            Transform result = scale(1);
-            for (Transforms::reverse_iterator it = individual.rbegin(),
-                    end = individual.rend(); it != end; ++it)
-                result = multiply(result, *it);
-            makeCurrent(result);
+            assert (stack.size() > 1);
+
+            // The product of the remaining transforms is still known.
+            stack.pop_back();
         }
     };
 }
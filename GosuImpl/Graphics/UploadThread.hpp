@@ -0,0 +1,122 @@
+#ifndef GOSUIMPL_GRAPHICS_UPLOADTHREAD_HPP
+#define GOSUIMPL_GRAPHICS_UPLOADTHREAD_HPP
+
+#include <Gosu/TR1.hpp>
+#include "Common.hpp"
+#include "../Threading.hpp"
+#include <deque>
+#include <stdexcept>
+#include <string>
+
+// Runs GL jobs, such as texture uploads, on a thread of its own whose
+// context shares textures with the main thread's. Jobs run in the order
+// they were scheduled, and each is followed by glFinish, so that the main
+// thread's context sees its results as soon as waitFor returns.
+class Gosu::UploadThread
+{
+    std::tr1::function<void()> setUp, tearDown;
+
+    Mutex mutex;
+    ConditionVariable changed;
+    std::deque<std::tr1::function<void()> > jobs;
+    // Tickets of the last scheduled and the last finished job.
+    std::tr1::uint64_t scheduled, finished;
+    bool ready, quitting;
+    std::string error;
+
+    // Must be the last member so that everything else is set up when it starts.
+    Thread thread;
+
+    void run()
+    {
+        try
+        {
+            setUp();
+            // The context must be current from here on.
+            if (!glGetString(GL_VERSION))
+                throw std::runtime_error("No OpenGL context on the upload thread");
+        }
+        catch (const std::exception& e)
+        {
+            Lock lock(mutex);
+            error = e.what();
+            ready = true;
+            changed.notifyAll();
+            return;
+        }
+
+        {
+            Lock lock(mutex);
+            ready = true;
+            changed.notifyAll();
+        }
+
+        for (;;)
+        {
+            std::tr1::function<void()> job;
+            {
+                Lock lock(mutex);
+                while (jobs.empty() && !quitting)
+                    changed.wait(mutex);
+                if (jobs.empty())
+                    break;
+                job.swap(jobs.front());
+                jobs.pop_front();
+            }
+
+            job();
+            glFinish();
+
+            Lock lock(mutex);
+            ++finished;
+            changed.notifyAll();
+        }
+
+        tearDown();
+    }
+
+public:
+    // setUp is called on the new thread to make a GL context current, and
+    // tearDown before the thread ends. Throws if setUp fails.
+    UploadThread(const std::tr1::function<void()>& setUp,
+        const std::tr1::function<void()>& tearDown)
+    : setUp(setUp), tearDown(tearDown), scheduled(0), finished(0), ready(false), quitting(false),
+      thread(std::tr1::bind(&UploadThread::run, this))
+    {
+        Lock lock(mutex);
+        while (!ready)
+            changed.wait(mutex);
+        if (!error.empty())
+            throw std::runtime_error(error);
+    }
+
+    // Runs the remaining jobs first.
+    ~UploadThread()
+    {
+        {
+            Lock lock(mutex);
+            quitting = true;
+            changed.notifyAll();
+        }
+        thread.join();
+    }
+
+    // Returns a ticket to wait for.
+    std::tr1::uint64_t schedule(const std::tr1::function<void()>& job)
+    {
+        Lock lock(mutex);
+        jobs.push_back(job);
+        changed.notifyAll();
+        return ++scheduled;
+    }
+
+    // Waits until the job with this ticket, and all before it, are done.
+    void waitFor(std::tr1::uint64_t ticket)
+    {
+        Lock lock(mutex);
+        while (finished < ticket)
+            changed.wait(mutex);
+    }
+};
+
+#endif
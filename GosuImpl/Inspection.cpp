@@ -1,5 +1,11 @@
 #include <Gosu/Inspection.hpp>
+#include <Gosu/IO.hpp>
 #include <Gosu/Timing.hpp>
+#include "Threading.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
 
 namespace Gosu
 {
@@ -18,10 +24,173 @@ namespace Gosu
                 accum = 0;
             }
         }
+        
+        FrameStats lastStats = FrameStats();
+        
+        // The last FRAME_TIME_WINDOW frame times, used as a ring buffer.
+        std::vector<double> frameTimes;
+        std::size_t nextFrameTime;
+        std::tr1::uint64_t lastFrameEnd;
+        
+        void registerFrameStats(const FrameStats& stats)
+        {
+            lastStats = stats;
+            
+            std::tr1::uint64_t now = nanoseconds();
+            if (lastFrameEnd != 0)
+            {
+                double frameTime = (now - lastFrameEnd) / 1000000.0;
+                if (frameTimes.size() < FRAME_TIME_WINDOW)
+                    frameTimes.push_back(frameTime);
+                else
+                    frameTimes[nextFrameTime] = frameTime;
+                nextFrameTime = (nextFrameTime + 1) % FRAME_TIME_WINDOW;
+            }
+            lastFrameEnd = now;
+        }
+        
+        // Called by windows after they have presented a frame themselves.
+        void registerSwapWait(double milliseconds)
+        {
+            lastStats.swapWait = milliseconds;
+        }
+    }
+    
+    namespace Tracing
+    {
+        struct Zone
+        {
+            const char* name;
+            std::tr1::uint64_t start, end;
+            unsigned thread;
+        };
+        
+        // Only checked without the mutex to keep disabled zones cheap.
+        volatile bool enabled = false;
+        Mutex mutex;
+        std::vector<Zone> zones;
+        std::tr1::uint64_t startTime;
+        unsigned lastThread;
+        GOSU_THREAD_LOCAL unsigned thread = 0;
+        
+        void record(const char* name, std::tr1::uint64_t start, std::tr1::uint64_t end)
+        {
+            Lock lock(mutex);
+            if (!enabled || start < startTime)
+                return;
+            if (thread == 0)
+                thread = ++lastThread;
+            Zone zone = { name, start, end, thread };
+            zones.push_back(zone);
+        }
+        
+        void appendJSONString(std::string& json, const char* str)
+        {
+            json += '"';
+            for (; *str; ++str)
+            {
+                if (*str == '"' || *str == '\\')
+                    json += '\\';
+                if (static_cast<unsigned char>(*str) < 0x20)
+                    json += ' ';
+                else
+                    json += *str;
+            }
+            json += '"';
+        }
+        
+        // Not via printf, which would use the user's decimal separator.
+        void appendMicroseconds(std::string& json, std::tr1::uint64_t nanoseconds)
+        {
+            char digits[32];
+            char* first = digits + sizeof digits;
+            std::tr1::uint64_t value = nanoseconds;
+            for (int i = 0; i < 3; ++i, value /= 10)
+                *--first = '0' + value % 10;
+            *--first = '.';
+            do
+                *--first = '0' + value % 10;
+            while (value /= 10);
+            json.append(first, digits + sizeof digits);
+        }
     }
     
     int fps()
     {
         return FPS::fps;
     }
+    
+    unsigned culledDrawOps()
+    {
+        return FPS::lastStats.culledDrawOps;
+    }
+    
+    FrameStats frameStats()
+    {
+        FrameStats result = FPS::lastStats;
+        
+        std::vector<double> sorted(FPS::frameTimes);
+        if (!sorted.empty())
+        {
+            std::sort(sorted.begin(), sorted.end());
+            std::size_t last = sorted.size() - 1;
+            result.frameTimeMedian = sorted[last / 2];
+            result.frameTime95 = sorted[last * 95 / 100];
+            result.frameTime99 = sorted[last * 99 / 100];
+            result.frameTimeMax = sorted[last];
+        }
+        return result;
+    }
+}
+
+void Gosu::beginTracing()
+{
+    Lock lock(Tracing::mutex);
+    Tracing::zones.clear();
+    Tracing::startTime = nanoseconds();
+    Tracing::enabled = true;
+}
+
+void Gosu::endTracing(const std::wstring& filename)
+{
+    std::vector<Tracing::Zone> zones;
+    std::tr1::uint64_t startTime;
+    {
+        Lock lock(Tracing::mutex);
+        Tracing::enabled = false;
+        zones.swap(Tracing::zones);
+        startTime = Tracing::startTime;
+    }
+    
+    // Complete events ("ph": "X") with timestamps in microseconds.
+    std::string json = "{\"traceEvents\":[";
+    for (std::size_t i = 0; i < zones.size(); ++i)
+    {
+        json += i == 0 ? "\n{\"name\":" : ",\n{\"name\":";
+        Tracing::appendJSONString(json, zones[i].name);
+        json += ",\"ph\":\"X\",\"ts\":";
+        Tracing::appendMicroseconds(json, zones[i].start - startTime);
+        json += ",\"dur\":";
+        Tracing::appendMicroseconds(json, zones[i].end - zones[i].start);
+        char thread[32];
+        std::sprintf(thread, ",\"pid\":1,\"tid\":%u}", zones[i].thread);
+        json += thread;
+    }
+    json += "\n],\"displayTimeUnit\":\"ms\"}\n";
+    
+    File file(filename, fmReplace);
+    file.write(0, json.size(), json.data());
+}
+
+Gosu::TraceZone::TraceZone(const char* name)
+: name(Tracing::enabled ? name : 0), start(0)
+{
+    if (this->name)
+        start = nanoseconds();
+}
+
+Gosu::TraceZone::~TraceZone()
+{
+    if (name)
+        Tracing::record(name, start, nanoseconds());
 }
@@ -1,3 +1,4 @@
+#include <Gosu/Inspection.hpp>
 #include <Gosu/Sockets.hpp>
 #include <Gosu/TR1.hpp>
 #include "Socket.hpp"
@@ -176,6 +177,7 @@ void Gosu::CommSocket::setKeepAlive(bool value)
 
 void Gosu::CommSocket::update()
 {
+    TraceZone zone("CommSocket::update");
     sendPendingData();
 
     if (!connected())
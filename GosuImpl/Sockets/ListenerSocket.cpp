@@ -1,3 +1,4 @@
+#include <Gosu/Inspection.hpp>
 #include <Gosu/Sockets.hpp>
 #include "Socket.hpp"
 #include <cassert>
@@ -44,6 +45,7 @@ Gosu::SocketPort Gosu::ListenerSocket::port() const
 
 void Gosu::ListenerSocket::update()
 {
+    TraceZone zone("ListenerSocket::update");
     while (onConnection)
     {
         SocketHandle newHandle =
@@ -1,3 +1,4 @@
+#include <Gosu/Inspection.hpp>
 #include <Gosu/Sockets.hpp>
 #include "Socket.hpp"
 #include <cassert>
@@ -56,6 +57,7 @@ std::size_t Gosu::MessageSocket::maxMessageSize() const
 
 void Gosu::MessageSocket::update()
 {
+    TraceZone zone("MessageSocket::update");
     std::vector<char> buffer(maxMessageSize());
 
     sockaddr_in addr;
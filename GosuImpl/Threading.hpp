@@ -0,0 +1,165 @@
+#ifndef GOSUIMPL_THREADING_HPP
+#define GOSUIMPL_THREADING_HPP
+
+#include <Gosu/Platform.hpp>
+#include <Gosu/TR1.hpp>
+#include <stdexcept>
+
+#ifdef GOSU_IS_WIN
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+// For condition variables.
+#if !defined(_WIN32_WINNT) || _WIN32_WINNT < 0x0600
+#undef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+// Storage class for plain old data that every thread has its own copy of.
+#ifdef _MSC_VER
+#define GOSU_THREAD_LOCAL __declspec(thread)
+#else
+#define GOSU_THREAD_LOCAL __thread
+#endif
+
+namespace Gosu
+{
+    // Minimal mutex until we can rely on std::mutex.
+    class Mutex
+    {
+        Mutex(const Mutex&);
+        Mutex& operator=(const Mutex&);
+        
+        friend class ConditionVariable;
+
+        #ifdef GOSU_IS_WIN
+        CRITICAL_SECTION section;
+        #else
+        pthread_mutex_t mutex;
+        #endif
+
+    public:
+        #ifdef GOSU_IS_WIN
+        Mutex() { InitializeCriticalSection(&section); }
+        ~Mutex() { DeleteCriticalSection(&section); }
+        void lock() { EnterCriticalSection(&section); }
+        void unlock() { LeaveCriticalSection(&section); }
+        #else
+        Mutex() { pthread_mutex_init(&mutex, 0); }
+        ~Mutex() { pthread_mutex_destroy(&mutex); }
+        void lock() { pthread_mutex_lock(&mutex); }
+        void unlock() { pthread_mutex_unlock(&mutex); }
+        #endif
+    };
+
+    class Lock
+    {
+        Lock(const Lock&);
+        Lock& operator=(const Lock&);
+
+        Mutex& mutex;
+
+    public:
+        explicit Lock(Mutex& mutex)
+        : mutex(mutex)
+        {
+            mutex.lock();
+        }
+
+        ~Lock()
+        {
+            mutex.unlock();
+        }
+    };
+    
+    class ConditionVariable
+    {
+        ConditionVariable(const ConditionVariable&);
+        ConditionVariable& operator=(const ConditionVariable&);
+        
+        #ifdef GOSU_IS_WIN
+        CONDITION_VARIABLE variable;
+        #else
+        pthread_cond_t variable;
+        #endif
+        
+    public:
+        #ifdef GOSU_IS_WIN
+        ConditionVariable() { InitializeConditionVariable(&variable); }
+        // The mutex must be locked by the calling thread.
+        void wait(Mutex& mutex) { SleepConditionVariableCS(&variable, &mutex.section, INFINITE); }
+        void notifyAll() { WakeAllConditionVariable(&variable); }
+        #else
+        ConditionVariable() { pthread_cond_init(&variable, 0); }
+        ~ConditionVariable() { pthread_cond_destroy(&variable); }
+        // The mutex must be locked by the calling thread.
+        void wait(Mutex& mutex) { pthread_cond_wait(&variable, &mutex.mutex); }
+        void notifyAll() { pthread_cond_broadcast(&variable); }
+        #endif
+    };
+    
+    // Runs a function on a new thread. The destructor waits for it to finish.
+    class Thread
+    {
+        Thread(const Thread&);
+        Thread& operator=(const Thread&);
+        
+        std::tr1::function<void()> function;
+        bool joined;
+        
+        #ifdef GOSU_IS_WIN
+        HANDLE handle;
+        
+        static DWORD WINAPI run(LPVOID self)
+        {
+            static_cast<Thread*>(self)->function();
+            return 0;
+        }
+        #else
+        pthread_t thread;
+        
+        static void* run(void* self)
+        {
+            static_cast<Thread*>(self)->function();
+            return 0;
+        }
+        #endif
+        
+    public:
+        explicit Thread(const std::tr1::function<void()>& function)
+        : function(function), joined(false)
+        {
+            #ifdef GOSU_IS_WIN
+            handle = CreateThread(0, 0, &Thread::run, this, 0, 0);
+            if (!handle)
+            #else
+            if (pthread_create(&thread, 0, &Thread::run, this) != 0)
+            #endif
+                throw std::runtime_error("Could not create thread");
+        }
+        
+        ~Thread()
+        {
+            join();
+        }
+        
+        void join()
+        {
+            if (joined)
+                return;
+            joined = true;
+            #ifdef GOSU_IS_WIN
+            WaitForSingleObject(handle, INFINITE);
+            CloseHandle(handle);
+            #else
+            pthread_join(thread, 0);
+            #endif
+        }
+    };
+}
+
+#endif
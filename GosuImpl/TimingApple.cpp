@@ -6,6 +6,11 @@ void Gosu::sleep(unsigned milliseconds)
 	usleep(milliseconds * 1000);
 }
 
+void Gosu::sleepNanoseconds(std::tr1::uint64_t nanoseconds)
+{
+    usleep(nanoseconds / 1000);
+}
+
 // Thanks to this blog for the unconvoluted code example:
 // http://shiftedbits.org/2008/10/01/mach_absolute_time-on-the-iphone/
 
@@ -25,3 +30,14 @@ unsigned long Gosu::milliseconds()
     uint64_t runtime = mach_absolute_time() - firstTick;
 	return runtime * info.numer / info.denom / 1000000.0;
 }
+
+std::tr1::uint64_t Gosu::nanoseconds()
+{
+    static mach_timebase_info_data_t info;
+    if (info.denom == 0)
+        mach_timebase_info(&info);
+    
+    // Split up to avoid overflowing 64 bits with large numerators.
+    std::tr1::uint64_t ticks = mach_absolute_time();
+    return ticks / info.denom * info.numer + ticks % info.denom * info.numer / info.denom;
+}
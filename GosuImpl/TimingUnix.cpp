@@ -1,6 +1,7 @@
 #include <Gosu/Timing.hpp>
 #include <unistd.h>
 #include <sys/time.h>
+#include <time.h>
 
 void Gosu::sleep(unsigned milliseconds)
 {
@@ -22,3 +23,19 @@ unsigned long Gosu::milliseconds()
     // No, don't ask why this is an unsigned long then :)
     return (tp.tv_usec / 1000UL + tp.tv_sec * 1000UL - start) & 0x1fffffff;
 }
+
+std::tr1::uint64_t Gosu::nanoseconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return std::tr1::uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void Gosu::sleepNanoseconds(std::tr1::uint64_t nanoseconds)
+{
+    timespec ts;
+    ts.tv_sec = nanoseconds / 1000000000;
+    ts.tv_nsec = nanoseconds % 1000000000;
+    // Restart when interrupted by a signal.
+    while (nanosleep(&ts, &ts) != 0 && (ts.tv_sec > 0 || ts.tv_nsec > 0));
+}
@@ -13,6 +13,18 @@ namespace
     {
         ::timeEndPeriod(1);
     }
+    
+    // Makes Sleep() and timeGetTime() precise to a millisecond.
+    void requestTimerPeriod()
+    {
+        static bool requested = false;
+        if (!requested)
+        {
+            requested = true;
+            if (::timeBeginPeriod(1) == TIMERR_NOERROR)
+                std::atexit(resetTGT);
+        }
+    }
 }
 
 unsigned long Gosu::milliseconds()
@@ -21,8 +33,7 @@ unsigned long Gosu::milliseconds()
 
     if (!start)
     {
-        if (::timeBeginPeriod(1) != TIMERR_NOERROR)
-            std::atexit(resetTGT);
+        requestTimerPeriod();
 				start = ::timeGetTime();
     }
     // Truncate to 2^30, C++ users shouldn't mind and Ruby users will
@@ -30,3 +41,21 @@ unsigned long Gosu::milliseconds()
     // No, don't ask why this is an unsigned long then :)
     return (::timeGetTime() - start) & 0x1fffffff;
 }
+
+std::tr1::uint64_t Gosu::nanoseconds()
+{
+    static LARGE_INTEGER frequency = { 0 };
+    if (frequency.QuadPart == 0)
+        ::QueryPerformanceFrequency(&frequency);
+    
+    LARGE_INTEGER counter;
+    ::QueryPerformanceCounter(&counter);
+    std::tr1::uint64_t ticks = counter.QuadPart, perSecond = frequency.QuadPart;
+    return ticks / perSecond * 1000000000 + ticks % perSecond * 1000000000 / perSecond;
+}
+
+void Gosu::sleepNanoseconds(std::tr1::uint64_t nanoseconds)
+{
+    requestTimerPeriod();
+    ::Sleep(static_cast<DWORD>(nanoseconds / 1000000));
+}
@@ -21,6 +21,7 @@ namespace Gosu
     namespace FPS
     {
         void registerFrame();
+        void registerSwapWait(double milliseconds);
     }
     
     NSRect screenRect = [[NSScreen mainScreen] frame];
@@ -550,8 +551,12 @@ void Gosu::Window::Impl::doTick(Window& window)
     {
         FPS::registerFrame();
         window.draw();
-        window.graphics().end();
-        [window.pimpl->context.obj() flushBuffer];
+        if (window.graphics().end())
+        {
+            std::tr1::uint64_t startTime = nanoseconds();
+            [window.pimpl->context.obj() flushBuffer];
+            FPS::registerSwapWait((nanoseconds() - startTime) / 1000000.0);
+        }
     }
     
     if (GosusDarkSide::oncePerTick) GosusDarkSide::oncePerTick();
@@ -11,6 +11,7 @@
 #include <Gosu/TextInput.hpp>
 #include <Gosu/TR1.hpp>
 #include <GosuImpl/Graphics/Common.hpp>
+#include <GosuImpl/FramePacer.hpp>
 #include <cassert>
 #include <memory>
 #include <stdexcept>
@@ -26,6 +27,7 @@ namespace Gosu
     namespace FPS
     {
         void registerFrame();
+        void registerSwapWait(double milliseconds);
     }
 
     unsigned screenWidth()
@@ -181,11 +183,13 @@ struct Gosu::Window::Impl
     std::auto_ptr<Input> input;
     double updateInterval;
     bool iconified;
+    // Set while a WM_PAINT that the main loop asked for is pending.
+    bool paintRequested;
 
     unsigned originalWidth, originalHeight;
 
     Impl()
-    : handle(0), hdc(0), iconified(false)
+    : handle(0), hdc(0), iconified(false), paintRequested(false)
     {
     }
 
@@ -343,7 +347,7 @@ void Gosu::Window::show()
     {
         Win::processMessages();
 
-        unsigned lastTick = 0;
+        FramePacer pacer(pimpl->updateInterval);
 
         for (;;)
         {
@@ -356,11 +360,9 @@ void Gosu::Window::show()
                 return;
             }
 
-            unsigned ms = milliseconds();
-
-            if (ms < lastTick || ms - lastTick >= static_cast<unsigned>(pimpl->updateInterval))
+            if (pacer.due())
             {
-                lastTick = ms;
+                pacer.advance();
                 Song::update();
                 input().update();
                 // TODO: Bad heuristic -- this causes flickering cursor on right and bottom border of the
@@ -370,7 +372,13 @@ void Gosu::Window::show()
                 update();
                 if (needsRedraw())
                 {
+                    // If part of the window is invalid already, the system
+                    // damaged it (e.g. by uncovering it), so the next frame
+                    // must not be skipped as identical.
+                    if (::GetUpdateRect(handle(), 0, FALSE))
+                        graphics().invalidate();
                     ::InvalidateRect(handle(), 0, FALSE);
+                    pimpl->paintRequested = true;
                     FPS::registerFrame();
                 }
                 // There probably should be a proper "oncePerTick" handler
@@ -378,10 +386,10 @@ void Gosu::Window::show()
                 // timeslices to Ruby's green threads in Ruby/Gosu.
                 if (GosusDarkSide::oncePerTick) GosusDarkSide::oncePerTick();
             }
-            else if (pimpl->updateInterval - (ms - lastTick) > 5)
-                // More than 5 ms left until next update: Sleep to reduce
-                // processur usage, Sleep() is accurate enough for that.
-                Sleep(5);
+            else
+                // Wait in small steps so that messages are still handled
+                // promptly; the pacer spins for the last bit of each tick.
+                pacer.wait(2000000);
         }
     }
     catch (...)
@@ -478,12 +486,18 @@ LRESULT Gosu::Window::handleMessage(UINT message, WPARAM wparam, LPARAM lparam)
         PAINTSTRUCT ps;
         pimpl->hdc = BeginPaint(handle(), &ps);
         
+        // Paints that the main loop did not ask for come from the system.
+        if (!pimpl->paintRequested && pimpl->graphics.get())
+            graphics().invalidate();
+        pimpl->paintRequested = false;
+        
+        bool rendered = true;
         if (pimpl->graphics.get() && graphics().begin())
         {
             try
             {
                 draw();
-                graphics().end();
+                rendered = graphics().end();
             }
             catch (std::exception& e)
             {
@@ -492,7 +506,12 @@ LRESULT Gosu::Window::handleMessage(UINT message, WPARAM wparam, LPARAM lparam)
             }
         }
         
-        SwapBuffers(pimpl->hdc);
+        if (rendered)
+        {
+            std::tr1::uint64_t startTime = nanoseconds();
+            SwapBuffers(pimpl->hdc);
+            FPS::registerSwapWait((nanoseconds() - startTime) / 1000000.0);
+        }
         EndPaint(handle(), &ps);
         return 0;
     }
@@ -21,6 +21,7 @@
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include "X11vroot.h"
+#include "FramePacer.hpp"
 
 #include <X11/extensions/Xinerama.h>
 
@@ -31,6 +32,7 @@ namespace Gosu
     namespace FPS
     {
         void registerFrame();
+        void registerSwapWait(double milliseconds);
     }
 
     void screenMetrics(int *x_org, int *y_org, int *width, int *height){
@@ -116,15 +118,85 @@ struct Gosu::Window::Impl
 
     double updateInterval;
     bool fullscreen;
+    
+    // Pipelined rendering: the render thread draws through its own connection
+    // and a context that shares textures with the main one.
+    bool pipelined;
+    ::Display* renderDisplay;
+    ::GLXContext renderContext;
 
     Impl(unsigned width, unsigned height, unsigned fullscreen, double updateInterval)
     :   mapped(false), showing(false), active(true),
         x(0), y(0), width(width), height(height),
-        updateInterval(updateInterval), fullscreen(fullscreen)
+        updateInterval(updateInterval), fullscreen(fullscreen),
+        pipelined(false), renderDisplay(0), renderContext(0)
     {
         
     }
     
+    static void makeRenderContextCurrent(::Display* display, ::Window window, ::GLXContext context)
+    {
+        if (!glXMakeCurrent(display, window, context))
+            throw std::runtime_error("Could not make the render thread's GLX context current");
+    }
+    
+    static void releaseRenderContext(::Display* display)
+    {
+        glXMakeCurrent(display, None, 0);
+    }
+    
+    void startRenderThread()
+    {
+        renderDisplay = XOpenDisplay(DisplayString(display));
+        if (!renderDisplay)
+            throw std::runtime_error("Could not duplicate X display");
+        renderContext = glXCreateContext(renderDisplay, visual, context, True);
+        if (!renderContext)
+        {
+            XCloseDisplay(renderDisplay);
+            renderDisplay = 0;
+            throw std::runtime_error("Could not create shared GLX context");
+        }
+        
+        try
+        {
+            graphics->startRenderThread(
+                std::tr1::bind(makeRenderContextCurrent, renderDisplay, window, renderContext),
+                std::tr1::bind(glXSwapBuffers, renderDisplay, window),
+                std::tr1::bind(releaseRenderContext, renderDisplay));
+        }
+        catch (...)
+        {
+            glXDestroyContext(renderDisplay, renderContext);
+            XCloseDisplay(renderDisplay);
+            renderDisplay = 0;
+            renderContext = 0;
+            throw;
+        }
+    }
+    
+    void stopRenderThread()
+    {
+        if (!renderDisplay)
+            return;
+        graphics->stopRenderThread();
+        glXDestroyContext(renderDisplay, renderContext);
+        XCloseDisplay(renderDisplay);
+        renderDisplay = 0;
+        renderContext = 0;
+    }
+    
+    void swapBuffers()
+    {
+        // Otherwise, the render thread presents frames.
+        if (!renderDisplay)
+        {
+            std::tr1::uint64_t startTime = nanoseconds();
+            glXSwapBuffers(display, window);
+            FPS::registerSwapWait((nanoseconds() - startTime) / 1000000.0);
+        }
+    }
+    
     void executeAndWait(std::tr1::function<void(Display*, ::Window)> function, int forMessage)
     {
         XSelectInput(display, window, StructureNotifyMask);
@@ -168,12 +240,14 @@ struct Gosu::Window::Impl
                 else if (event.type == FocusOut)
                     active = false;
             }
+            if (event.type == Expose && event.xexpose.count == 0)
+                window->graphics().invalidate();
             if (event.type == Expose && event.xexpose.count == 0 &&
                         window->graphics().begin(Colors::black)) {
                 FPS::registerFrame();
                 window->draw();
-                window->graphics().end();
-                glXSwapBuffers(display, this->window);
+                if (window->graphics().end())
+                    swapBuffers();
             }
         }
         
@@ -196,8 +270,8 @@ struct Gosu::Window::Impl
         {
             FPS::registerFrame();
             window->draw();
-            window->graphics().end();
-            glXSwapBuffers(display, this->window);
+            if (window->graphics().end())
+                swapBuffers();
         }
     }
 };
@@ -369,21 +443,23 @@ void Gosu::Window::show()
     }
     
     setCaption(pimpl->title);
+    
+    if (pimpl->pipelined)
+        pimpl->startRenderThread();
 
-    unsigned startTime, endTime;
+    FramePacer pacer(pimpl->updateInterval);
 
     pimpl->showing = true;
     while (pimpl->showing)
     {
-        startTime = milliseconds();
         pimpl->doTick(this);
         if (GosusDarkSide::oncePerTick) GosusDarkSide::oncePerTick();
-        endTime = milliseconds();
 
-        if (startTime <= endTime && (endTime - startTime) < pimpl->updateInterval)
-            sleep(pimpl->updateInterval - (endTime - startTime));
+        pacer.wait();
+        pacer.advance();
     }
 
+    pimpl->stopRenderThread();
     glXMakeCurrent(pimpl->display, 0, 0);
     pimpl->executeAndWait(XUnmapWindow, UnmapNotify);
     pimpl->mapped = false;
@@ -394,6 +470,13 @@ void Gosu::Window::close()
     pimpl->showing = false;
 }
 
+void Gosu::Window::setPipelinedRendering(bool enabled)
+{
+    if (pimpl->showing)
+        throw std::logic_error("Pipelined rendering must be set up before the window is shown");
+    pimpl->pipelined = enabled;
+}
+
 const Gosu::Graphics& Gosu::Window::graphics() const
 {
     return *pimpl->graphics;
@@ -0,0 +1,91 @@
+#ifndef GOSUIMPL_WORKERPOOL_HPP
+#define GOSUIMPL_WORKERPOOL_HPP
+
+#include <Gosu/TR1.hpp>
+#include "Threading.hpp"
+#include <deque>
+#include <vector>
+
+namespace Gosu
+{
+    // Runs jobs on a fixed number of threads, in the order they were
+    // scheduled. Jobs must not throw. The destructor waits for the jobs
+    // that are running and drops the ones that have not started, so that
+    // quitting during a long load does not wait for the whole queue.
+    class WorkerPool
+    {
+        WorkerPool(const WorkerPool&);
+        WorkerPool& operator=(const WorkerPool&);
+
+        Mutex mutex;
+        ConditionVariable changed;
+        std::deque<std::tr1::function<void()> > jobs;
+        bool quitting;
+        // Must be the last member so that everything else is set up when
+        // the threads start.
+        std::vector<std::tr1::shared_ptr<Thread> > threads;
+
+        void run()
+        {
+            for (;;)
+            {
+                std::tr1::function<void()> job;
+                {
+                    Lock lock(mutex);
+                    while (jobs.empty() && !quitting)
+                        changed.wait(mutex);
+                    if (quitting)
+                        break;
+                    job.swap(jobs.front());
+                    jobs.pop_front();
+                }
+                job();
+            }
+        }
+
+        void stop()
+        {
+            // Destroyed outside the lock, as the jobs may own anything.
+            std::deque<std::tr1::function<void()> > dropped;
+            {
+                Lock lock(mutex);
+                quitting = true;
+                dropped.swap(jobs);
+                changed.notifyAll();
+            }
+            // Joins the threads.
+            threads.clear();
+        }
+
+    public:
+        explicit WorkerPool(unsigned threadCount)
+        : quitting(false)
+        {
+            try
+            {
+                for (unsigned i = 0; i < threadCount; ++i)
+                    threads.push_back(std::tr1::shared_ptr<Thread>(
+                        new Thread(std::tr1::bind(&WorkerPool::run, this))));
+            }
+            catch (...)
+            {
+                stop();
+                throw;
+            }
+        }
+
+        ~WorkerPool()
+        {
+            stop();
+        }
+
+        void schedule(const std::tr1::function<void()>& job)
+        {
+            Lock lock(mutex);
+            jobs.push_back(job);
+            changed.notifyAll();
+        }
+    };
+}
+
+#endif
@@ -61,7 +61,7 @@ endif()
 
 #Projects source files
 SET(CORE_SRC_FILES
-    #Async.cpp
+    Async.cpp
     Inspection.cpp
     IO.cpp
     Math.cpp
@@ -73,10 +73,12 @@ SET(CORE_SRC_FILES
     Graphics/BlockAllocator.cpp
     Graphics/Color.cpp
     Graphics/Font.cpp
+    Graphics/GLExtensions.cpp
     Graphics/Graphics.cpp
     Graphics/Image.cpp
     Graphics/LargeImageData.cpp
     Graphics/TexChunk.cpp
+    Graphics/Tilemap.cpp
     Graphics/Texture.cpp
     Graphics/Transform.cpp
     Sockets/CommSocket.cpp
@@ -234,6 +236,15 @@ IF(BUILD_DYNAMIC_LIBRARIES)
 	# out of SOME reason, we cannot link to gl in the executable
     find_package(OpenGL REQUIRED)
 	target_link_libraries(GosuDynamic ${OPENGL_LIBRARY})
+	find_package(Threads REQUIRED)
+	target_link_libraries(GosuDynamic ${CMAKE_THREAD_LIBS_INIT})
+	# clock_gettime lives in librt on older glibc versions
+	IF(UNIX AND NOT APPLE)
+		find_library(RT_LIBRARY rt)
+		IF(RT_LIBRARY)
+			target_link_libraries(GosuDynamic ${RT_LIBRARY})
+		ENDIF()
+	ENDIF()
 	SET(Gosu_LIBRARY "GosuDynamic")
 ENDIF()
 
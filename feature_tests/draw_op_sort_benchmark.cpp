@@ -0,0 +1,100 @@
+// Compares Gosu's Z sorting engine for draw ops to a plain std::stable_sort
+// over fat op structs, as DrawOpQueue did before.
+// Build and run from this directory:
+//   g++ -O2 -I.. draw_op_sort_benchmark.cpp -o draw_op_sort_benchmark
+//   ./draw_op_sort_benchmark
+
+#include "../GosuImpl/Graphics/DrawOpSorter.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+
+namespace
+{
+    // Roughly the size of a DrawOp including its RenderState.
+    struct FatOp
+    {
+        Gosu::ZPos z;
+        unsigned index;
+        char payload[128];
+
+        bool operator<(const FatOp& other) const
+        {
+            return z < other.z;
+        }
+    };
+
+    enum Pattern { ptRandom, ptLayers, ptSorted };
+    const char* PATTERN_NAMES[] = { "random", "10 layers", "sorted" };
+
+    Gosu::ZPos makeZ(Pattern pattern, unsigned i)
+    {
+        switch (pattern)
+        {
+        case ptRandom:
+            return std::rand() / (RAND_MAX + 1.0) * 1000 - 500;
+        case ptLayers:
+            return std::rand() % 10;
+        default:
+            return i / 100;
+        }
+    }
+
+    double msSince(std::clock_t start)
+    {
+        return (std::clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+    }
+
+    void benchmark(unsigned n, Pattern pattern)
+    {
+        const int FRAMES = 5;
+
+        std::vector<Gosu::ZPos> zs(n);
+        for (unsigned i = 0; i < n; ++i)
+            zs[i] = makeZ(pattern, i);
+
+        std::vector<FatOp> ops(n);
+        double stableSortMs = 0;
+        for (int frame = 0; frame < FRAMES; ++frame)
+        {
+            for (unsigned i = 0; i < n; ++i)
+                ops[i].z = zs[i], ops[i].index = i;
+            std::clock_t start = std::clock();
+            std::stable_sort(ops.begin(), ops.end());
+            stableSortMs += msSince(start);
+        }
+
+        // The first frame cannot benefit from the previous frame's order.
+        Gosu::DrawOpSorter sorter;
+        double firstFrameMs = 0, laterFramesMs = 0;
+        for (int frame = 0; frame < FRAMES; ++frame)
+        {
+            std::clock_t start = std::clock();
+            for (unsigned i = 0; i < n; ++i)
+                sorter.addKey(zs[i]);
+            const Gosu::DrawOpSorter::Order& order = sorter.sort();
+            (frame == 0 ? firstFrameMs : laterFramesMs) += msSince(start);
+
+            for (unsigned i = 0; i < n; ++i)
+                if (order[i] != ops[i].index)
+                {
+                    std::printf("Mismatch at %u (%s, n = %u)!\n", i, PATTERN_NAMES[pattern], n);
+                    std::exit(EXIT_FAILURE);
+                }
+            sorter.clear();
+        }
+
+        std::printf("%8u ops, %-9s  stable_sort: %8.2f ms  sorter: %8.2f ms (first frame), %8.2f ms (later frames)\n",
+            n, PATTERN_NAMES[pattern], stableSortMs / FRAMES, firstFrameMs, laterFramesMs / (FRAMES - 1));
+    }
+}
+
+int main()
+{
+    unsigned sizes[] = { 10000, 100000, 1000000 };
+    for (int s = 0; s < 3; ++s)
+        for (int p = ptRandom; p <= ptSorted; ++p)
+            benchmark(sizes[s], Pattern(p));
+}
@@ -0,0 +1,411 @@
+// Compares BlockAllocator's MaxRects packing to the previous implementation,
+// which tried the spot next to the last block and then scanned the texture
+// on an 8x16 grid, testing each position against every block. Also compares
+// trying all textures in order to choosing one by BlockAllocator::mayFit and
+// the free area, as Graphics::createImage does now, and times freeing and
+// allocating blocks in a full texture.
+// With --check, instead allocates, frees and nests random blocks and compares
+// each step to a brute-force occupancy grid.
+// Build and run from this directory:
+//   g++ -O2 -I.. texture_atlas_benchmark.cpp ../GosuImpl/Graphics/BlockAllocator.cpp ../GosuImpl/Inspection.cpp ../GosuImpl/TimingUnix.cpp ../GosuImpl/IO.cpp ../GosuImpl/FileUnix.cpp ../GosuImpl/Utility.cpp -lpthread -o texture_atlas_benchmark
+//   ./texture_atlas_benchmark
+//   ./texture_atlas_benchmark --check [seed]
+
+#include "../GosuImpl/Graphics/BlockAllocator.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+namespace
+{
+    typedef Gosu::BlockAllocator::Block Block;
+
+    class LegacyBlockAllocator
+    {
+        unsigned width, height;
+        std::vector<Block> blocks;
+        unsigned firstX, firstY;
+        unsigned maxW, maxH;
+
+        void markBlockUsed(const Block& block, unsigned aWidth, unsigned aHeight)
+        {
+            firstX += aWidth;
+            if (firstX + aWidth >= width)
+            {
+                firstX = 0;
+                firstY += aHeight;
+            }
+            blocks.push_back(block);
+        }
+
+        bool isBlockFree(const Block& block) const
+        {
+            unsigned right = block.left + block.width;
+            unsigned bottom = block.top + block.height;
+            if (right > width || bottom > height)
+                return false;
+            for (std::size_t i = 0; i < blocks.size(); ++i)
+                if (blocks[i].left < right && block.left < blocks[i].left + blocks[i].width &&
+                    blocks[i].top < bottom && block.top < blocks[i].top + blocks[i].height)
+                    return false;
+            return true;
+        }
+
+    public:
+        LegacyBlockAllocator(unsigned width, unsigned height)
+        : width(width), height(height), firstX(0), firstY(0), maxW(width), maxH(height)
+        {
+        }
+
+        bool alloc(unsigned aWidth, unsigned aHeight, Block& b)
+        {
+            if (aWidth > width || aHeight > height)
+                return false;
+            if (aWidth > maxW && aHeight > maxH)
+                return false;
+
+            b = Block(firstX, firstY, aWidth, aHeight);
+            if (isBlockFree(b))
+            {
+                markBlockUsed(b, aWidth, aHeight);
+                return true;
+            }
+
+            unsigned& x = b.left;
+            unsigned& y = b.top;
+            for (y = 0; y <= height - aHeight; y += 16)
+                for (x = 0; x <= width - aWidth; x += 8)
+                {
+                    if (!isBlockFree(b))
+                        continue;
+                    while (y > 0 && isBlockFree(Block(x, y - 1, aWidth, aHeight)))
+                        --y;
+                    while (x > 0 && isBlockFree(Block(x - 1, y, aWidth, aHeight)))
+                        --x;
+                    markBlockUsed(b, aWidth, aHeight);
+                    return true;
+                }
+
+            maxW = aWidth - 1;
+            maxH = aHeight - 1;
+            return false;
+        }
+    };
+
+    const unsigned TEXTURE_SIZE = 1024;
+
+    // As Graphics::createImage used to: try all textures in order.
+    template<typename Allocator>
+    std::size_t findTexture(const std::vector<Allocator*>& textures, const Block& size, Block& b)
+    {
+        std::size_t t = 0;
+        while (t < textures.size() && !textures[t]->alloc(size.width, size.height, b))
+            ++t;
+        return t;
+    }
+
+    // As Graphics::createImage does now: try the fullest texture that the
+    // block may fit into first.
+    std::size_t findTextureIndexed(const std::vector<Gosu::BlockAllocator*>& textures,
+        const Block& size, Block& b)
+    {
+        std::vector<bool> rejected(textures.size());
+        for (;;)
+        {
+            std::size_t best = textures.size();
+            for (std::size_t t = 0; t < textures.size(); ++t)
+                if (!rejected[t] && textures[t]->mayFit(size.width, size.height) &&
+                    (best == textures.size() || textures[t]->usedArea() > textures[best]->usedArea()))
+                    best = t;
+            if (best == textures.size() || textures[best]->alloc(size.width, size.height, b))
+                return best;
+            rejected[best] = true;
+        }
+    }
+
+    // Only Gosu::BlockAllocator has mayFit.
+    std::size_t findTextureIndexed(const std::vector<LegacyBlockAllocator*>& textures,
+        const Block& size, Block& b)
+    {
+        return findTexture(textures, size, b);
+    }
+
+    // Starts a new texture when none has room.
+    template<typename Allocator>
+    void pack(const std::vector<Block>& sizes, std::vector<Allocator*>& textures,
+        std::vector<std::vector<Block> >& placed, bool indexed)
+    {
+        for (std::size_t i = 0; i < sizes.size(); ++i)
+        {
+            Block b;
+            std::size_t t = indexed ? findTextureIndexed(textures, sizes[i], b) :
+                findTexture(textures, sizes[i], b);
+            if (t == textures.size())
+            {
+                textures.push_back(new Allocator(TEXTURE_SIZE, TEXTURE_SIZE));
+                placed.resize(textures.size());
+                textures.back()->alloc(sizes[i].width, sizes[i].height, b);
+            }
+            placed[t].push_back(b);
+        }
+    }
+
+    void verify(const std::vector<std::vector<Block> >& placed,
+        unsigned textureSize = TEXTURE_SIZE)
+    {
+        for (std::size_t t = 0; t < placed.size(); ++t)
+            for (std::size_t i = 0; i < placed[t].size(); ++i)
+            {
+                const Block& a = placed[t][i];
+                if (a.left + a.width > textureSize || a.top + a.height > textureSize)
+                {
+                    std::printf("Block outside of the texture!\n");
+                    std::exit(EXIT_FAILURE);
+                }
+                for (std::size_t j = 0; j < i; ++j)
+                {
+                    const Block& b = placed[t][j];
+                    if (a.left < b.left + b.width && b.left < a.left + a.width &&
+                        a.top < b.top + b.height && b.top < a.top + a.height)
+                    {
+                        std::printf("Overlapping blocks!\n");
+                        std::exit(EXIT_FAILURE);
+                    }
+                }
+            }
+    }
+
+    double msSince(std::clock_t start)
+    {
+        return (std::clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+    }
+
+    template<typename Allocator>
+    void run(const char* name, const std::vector<Block>& sizes, bool indexed = false)
+    {
+        std::vector<Allocator*> textures;
+        std::vector<std::vector<Block> > placed;
+        std::clock_t start = std::clock();
+        pack(sizes, textures, placed, indexed);
+        double ms = msSince(start);
+        verify(placed);
+
+        std::printf("  %-10s %8.2f ms, %2u textures\n", name, ms, unsigned(textures.size()));
+        for (std::size_t t = 0; t < textures.size(); ++t)
+            delete textures[t];
+    }
+
+    void benchmark(const char* load, const std::vector<Block>& sizes, bool withLegacy = true)
+    {
+        std::printf("%u %s:\n", unsigned(sizes.size()), load);
+        if (withLegacy)
+            run<LegacyBlockAllocator>("legacy", sizes);
+        run<Gosu::BlockAllocator>("MaxRects", sizes);
+        run<Gosu::BlockAllocator>("+ mayFit", sizes, true);
+    }
+
+    // Fills a texture with tiles, then repeatedly frees a random one and
+    // allocates a new one, as when images come and go in a running game.
+    void churn(unsigned textureSize, unsigned rounds)
+    {
+        const unsigned TILE_SIZE = 18;
+        Gosu::BlockAllocator allocator(textureSize, textureSize);
+        std::vector<Block> placed;
+        Block b;
+        while (allocator.alloc(TILE_SIZE, TILE_SIZE, b))
+            placed.push_back(b);
+
+        std::clock_t start = std::clock();
+        for (unsigned i = 0; i < rounds; ++i)
+        {
+            std::size_t victim = std::rand() % placed.size();
+            const Block& freed = placed[victim];
+            allocator.free(freed.left, freed.top, freed.width, freed.height);
+            if (!allocator.alloc(TILE_SIZE, TILE_SIZE, placed[victim]))
+            {
+                std::printf("Could not reuse a freed block!\n");
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        double ms = msSince(start);
+
+        std::vector<std::vector<Block> > textures(1, placed);
+        verify(textures, textureSize);
+        std::printf("%u tiles of 16x16 in %ux%u, freeing and allocating %u:\n",
+            unsigned(placed.size()), textureSize, textureSize, rounds);
+        std::printf("  %-10s %8.3f ms per pair\n", "MaxRects", ms / rounds);
+    }
+
+    // How many live blocks cover each pixel of a texture.
+    class OccupancyGrid
+    {
+        unsigned size;
+        std::vector<unsigned> coverage;
+
+    public:
+        explicit OccupancyGrid(unsigned size)
+        : size(size), coverage(size * size)
+        {
+        }
+
+        void add(const Block& b, int delta)
+        {
+            for (unsigned y = b.top; y < b.top + b.height; ++y)
+                for (unsigned x = b.left; x < b.left + b.width; ++x)
+                    coverage[y * size + x] += delta;
+        }
+
+        bool isFree(const Block& b) const
+        {
+            if (b.left + b.width > size || b.top + b.height > size)
+                return false;
+            for (unsigned y = b.top; y < b.top + b.height; ++y)
+                for (unsigned x = b.left; x < b.left + b.width; ++x)
+                    if (coverage[y * size + x] != 0)
+                        return false;
+            return true;
+        }
+
+        // Tries every position, counting used pixels with a summed-area table.
+        bool hasRoomFor(unsigned width, unsigned height) const
+        {
+            if (width > size || height > size)
+                return false;
+            std::vector<unsigned> used((size + 1) * (size + 1));
+            for (unsigned y = 0; y < size; ++y)
+                for (unsigned x = 0; x < size; ++x)
+                    used[(y + 1) * (size + 1) + x + 1] = (coverage[y * size + x] != 0) +
+                        used[y * (size + 1) + x + 1] + used[(y + 1) * (size + 1) + x] -
+                        used[y * (size + 1) + x];
+            for (unsigned y = 0; y + height <= size; ++y)
+                for (unsigned x = 0; x + width <= size; ++x)
+                    if (used[(y + height) * (size + 1) + x + width] - used[y * (size + 1) + x + width] -
+                        used[(y + height) * (size + 1) + x] + used[y * (size + 1) + x] == 0)
+                        return true;
+            return false;
+        }
+    };
+
+    void fail(const char* message, const Block& b)
+    {
+        std::printf("%s: %u,%u %ux%u\n", message, b.left, b.top, b.width, b.height);
+        std::exit(EXIT_FAILURE);
+    }
+
+    // Allocates and frees random blocks, and blocks subimages within them
+    // as Texture::tryAlloc does, freeing parents and subimages in any order.
+    // alloc must only return free spots, and must only fail (as must mayFit)
+    // if there is no free spot of that size.
+    void check(unsigned textureSize, unsigned steps)
+    {
+        Gosu::BlockAllocator allocator(textureSize, textureSize);
+        OccupancyGrid grid(textureSize);
+        std::vector<Block> allocated, nested;
+        unsigned allocs = 0, failures = 0, frees = 0;
+
+        for (unsigned step = 0; step < steps; ++step)
+        {
+            unsigned action = std::rand() % 10;
+            if (action < 4)
+            {
+                unsigned width = 1 + std::rand() % (textureSize / 4);
+                unsigned height = 1 + std::rand() % (textureSize / 4);
+                Block b(0, 0, width, height);
+                bool mayFit = allocator.mayFit(width, height);
+                if (allocator.alloc(width, height, b))
+                {
+                    if (b.width != width || b.height != height || !grid.isFree(b))
+                        fail("alloc returned a spot that is not free", b);
+                    if (!mayFit)
+                        fail("mayFit was false for a block that fit", b);
+                    grid.add(b, 1);
+                    allocated.push_back(b);
+                    ++allocs;
+                }
+                else
+                {
+                    if (grid.hasRoomFor(width, height))
+                        fail("alloc failed although there was room", b);
+                    ++failures;
+                }
+            }
+            else if (action < 6 && !allocated.empty())
+            {
+                const Block& parent = allocated[std::rand() % allocated.size()];
+                unsigned width = 1 + std::rand() % parent.width;
+                unsigned height = 1 + std::rand() % parent.height;
+                Block b(parent.left + std::rand() % (parent.width - width + 1),
+                    parent.top + std::rand() % (parent.height - height + 1), width, height);
+                allocator.block(b.left, b.top, b.width, b.height);
+                grid.add(b, 1);
+                nested.push_back(b);
+            }
+            else
+            {
+                bool fromNested = allocated.empty() || (!nested.empty() && std::rand() % 2);
+                std::vector<Block>& list = fromNested ? nested : allocated;
+                if (list.empty())
+                    continue;
+                std::size_t victim = std::rand() % list.size();
+                Block b = list[victim];
+                list[victim] = list.back();
+                list.pop_back();
+                allocator.free(b.left, b.top, b.width, b.height);
+                grid.add(b, -1);
+                ++frees;
+            }
+        }
+
+        std::printf("%u random steps in %ux%u: %u allocated, %u failed, %u freed\n",
+            steps, textureSize, textureSize, allocs, failures, frees);
+    }
+
+    // Sizes include the padding of one pixel around each image.
+    std::vector<Block> tileSheet(unsigned n)
+    {
+        return std::vector<Block>(n, Block(0, 0, 34, 34));
+    }
+
+    std::vector<Block> glyphs(unsigned n)
+    {
+        std::vector<Block> sizes;
+        for (unsigned i = 0; i < n; ++i)
+            sizes.push_back(Block(0, 0, 4 + std::rand() % 40, 14 + std::rand() % 36));
+        return sizes;
+    }
+
+    std::vector<Block> sprites(unsigned n)
+    {
+        std::vector<Block> sizes;
+        for (unsigned i = 0; i < n; ++i)
+        {
+            unsigned size = 1 << (3 + std::rand() % 4);
+            sizes.push_back(Block(0, 0, size * (1 + std::rand() % 3) + 2, size + 2));
+        }
+        return sizes;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && std::strcmp(argv[1], "--check") == 0)
+    {
+        unsigned seed = argc > 2 ? std::atoi(argv[2]) : unsigned(std::time(0));
+        std::printf("Seed %u\n", seed);
+        std::srand(seed);
+        check(64, 100000);
+        check(256, 20000);
+        std::printf("OK\n");
+        return 0;
+    }
+
+    benchmark("tiles of 32x32", tileSheet(4000));
+    benchmark("glyphs of mixed size", glyphs(2500));
+    benchmark("sprites of mixed size", sprites(3000));
+    // Too slow for the old allocator.
+    benchmark("sprites of mixed size", sprites(30000), false);
+    churn(1024, 200);
+    churn(4096, 200);
+}
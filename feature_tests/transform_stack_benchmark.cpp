@@ -0,0 +1,135 @@
+// Compares Gosu's TransformStack to the previous implementation, which
+// searched a list of all absolute transforms on every push and pop, and
+// recomputed the product of the whole stack on every pop.
+// Build and run from this directory:
+//   g++ -O2 -I.. transform_stack_benchmark.cpp ../GosuImpl/Graphics/Transform.cpp -o transform_stack_benchmark
+//   ./transform_stack_benchmark
+
+#include "../GosuImpl/Graphics/TransformStack.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <list>
+
+namespace
+{
+    class LegacyTransformStack
+    {
+        typedef std::list<Gosu::Transform> Transforms;
+        Transforms individual, absolute;
+        Transforms::const_iterator currentIterator;
+
+        void makeCurrent(const Gosu::Transform& transform)
+        {
+            currentIterator = std::find(absolute.begin(), absolute.end(), transform);
+            if (currentIterator == absolute.end())
+                currentIterator = absolute.insert(absolute.end(), transform);
+        }
+
+    public:
+        LegacyTransformStack()
+        {
+            reset();
+            individual.front() = absolute.front() = Gosu::scale(1);
+        }
+
+        void reset()
+        {
+            individual.resize(1);
+            absolute.resize(1);
+            currentIterator = absolute.begin();
+        }
+
+        const Gosu::Transform& current() const
+        {
+            return *currentIterator;
+        }
+
+        void push(const Gosu::Transform& transform)
+        {
+            individual.push_back(transform);
+            makeCurrent(Gosu::multiply(transform, current()));
+        }
+
+        void pop()
+        {
+            individual.pop_back();
+            Gosu::Transform result = Gosu::scale(1);
+            for (Transforms::reverse_iterator it = individual.rbegin(),
+                    end = individual.rend(); it != end; ++it)
+                result = Gosu::multiply(result, *it);
+            makeCurrent(result);
+        }
+    };
+
+    enum Pattern { ptDeep, ptWide, ptRepeated };
+    const char* PATTERN_NAMES[] = { "deep", "wide", "repeated" };
+
+    // Every pattern performs 'pushes' pushes and as many pops.
+    template<typename Stack>
+    double run(Stack& stack, Pattern pattern, unsigned pushes, double& checksum)
+    {
+        std::clock_t start = std::clock();
+        stack.reset();
+        const unsigned DEPTH = 32;
+        for (unsigned i = 0; i < pushes; )
+        {
+            switch (pattern)
+            {
+            case ptDeep:
+                // Nested scene graph: translate, rotate, scale... 32 levels deep.
+                for (unsigned d = 0; d < DEPTH; ++d, ++i)
+                    stack.push(d % 2 ? Gosu::rotate(i % 360) : Gosu::translate(i % 97, d));
+                checksum += stack.current()[12];
+                for (unsigned d = 0; d < DEPTH; ++d)
+                    stack.pop();
+                break;
+            case ptWide:
+                // Flat UI: one distinct translation per widget.
+                stack.push(Gosu::translate(i % 1000, i / 1000));
+                checksum += stack.current()[12];
+                stack.pop();
+                ++i;
+                break;
+            case ptRepeated:
+                // The same few transforms over and over.
+                stack.push(Gosu::scale(2));
+                stack.push(Gosu::translate(i % 8, 0));
+                checksum += stack.current()[12];
+                stack.pop();
+                stack.pop();
+                i += 2;
+                break;
+            }
+        }
+        return (std::clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+    }
+
+    void benchmark(unsigned pushes, Pattern pattern)
+    {
+        double legacyChecksum = 0, checksum = 0;
+        LegacyTransformStack legacy;
+        double legacyMs = run(legacy, pattern, pushes, legacyChecksum);
+        Gosu::TransformStack stack;
+        double ms = run(stack, pattern, pushes, checksum);
+
+        if (std::abs(legacyChecksum - checksum) > 1e-6 * std::abs(legacyChecksum))
+        {
+            std::printf("Checksum mismatch (%s, %u pushes)!\n", PATTERN_NAMES[pattern], pushes);
+            std::exit(EXIT_FAILURE);
+        }
+
+        std::printf("%7u pushes, %-8s  legacy: %9.2f ms  TransformStack: %7.2f ms\n",
+            pushes, PATTERN_NAMES[pattern], legacyMs, ms);
+    }
+}
+
+int main()
+{
+    unsigned sizes[] = { 1000, 5000, 20000 };
+    for (int s = 0; s < 3; ++s)
+        for (int p = ptDeep; p <= ptRepeated; ++p)
+            benchmark(sizes[s], Pattern(p));
+}
@@ -14,6 +14,7 @@ puts 'https://github.com/jlnr/gosu/wiki/Getting-Started-on-Linux'
 puts
 
 BASE_FILES = %w(
+  Async.cpp
   DirectoriesUnix.cpp
   FileUnix.cpp
   Graphics/Bitmap.cpp
@@ -22,12 +23,14 @@ BASE_FILES = %w(
   Graphics/BlockAllocator.cpp
   Graphics/Color.cpp
   Graphics/Font.cpp
+  Graphics/GLExtensions.cpp
   Graphics/Graphics.cpp
   Graphics/Image.cpp
   Graphics/LargeImageData.cpp
   Graphics/TexChunk.cpp
   Graphics/Text.cpp
   Graphics/Texture.cpp
+  Graphics/Tilemap.cpp
   Graphics/Transform.cpp
   Inspection.cpp
   IO.cpp
@@ -109,6 +112,8 @@ else
   have_header 'SDL_ttf.h'   if have_library('SDL_ttf', 'TTF_RenderUTF8_Blended')
   have_header 'FreeImage.h' if have_library('freeimage', 'FreeImage_ConvertFromRawBits')
   have_header 'AL/al.h'     if have_library('openal')
+  have_library('pthread', 'pthread_mutex_init')
+  have_library('rt', 'clock_gettime')
 end
 
 # Symlink our pretty gosu.so into ../lib